@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#include "threads/vaddr.h"
 
 /* A block device. */
 struct block
@@ -120,9 +121,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +132,116 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from
+   BLOCK into BUFFER, which must have room for CNT *
+   BLOCK_SECTOR_SIZE bytes.  Uses a single multi-sector transfer
+   if BLOCK's driver supports one.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     block_sector_t cnt, void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&r, false, sector, cnt, buffer);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Uses a single multi-sector transfer if BLOCK's driver supports
+   one.  Returns after the block device has acknowledged
+   receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      block_sector_t cnt, const void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&r, true, sector, cnt, (void *) buffer);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Initializes R as a request to transfer the CNT sectors starting
+   at SECTOR between a block device and BUFFER, which must have
+   room for CNT * BLOCK_SECTOR_SIZE bytes.  The transfer is from
+   BUFFER to the device if WRITE is true, from the device to
+   BUFFER otherwise.  BUFFER must be in kernel memory, because the
+   driver may carry out the transfer in a thread of its own, whose
+   page directory does not map the submitter's user memory. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, block_sector_t cnt, void *buffer)
+{
+  ASSERT (cnt > 0);
+  ASSERT (is_kernel_vaddr (buffer));
+
+  r->aux = NULL;
+  r->write = write;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  sema_init (&r->done, 0);
+}
+
+/* Submits request R to BLOCK.  If BLOCK's driver queues
+   requests, returns without waiting for the transfer to
+   complete; use block_wait() to wait for it.  R must remain
+   valid until then. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  check_sector (block, r->sector);
+  check_sector (block, r->sector + r->cnt - 1);
+  if (r->write)
+    {
+      ASSERT (block->type != BLOCK_FOREIGN);
+      block->write_cnt += r->cnt;
+    }
+  else
+    block->read_cnt += r->cnt;
+
+  if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, r);
+  else
+    {
+      uint8_t *p = r->buffer;
+      block_sector_t i;
+
+      if (r->write && block->ops->write_multiple != NULL)
+        block->ops->write_multiple (block->aux, r->sector, r->cnt, p);
+      else if (!r->write && block->ops->read_multiple != NULL)
+        block->ops->read_multiple (block->aux, r->sector, r->cnt, p);
+      else
+        for (i = 0; i < r->cnt; i++, p += BLOCK_SECTOR_SIZE)
+          {
+            if (r->write)
+              block->ops->write (block->aux, r->sector + i, p);
+            else
+              block->ops->read (block->aux, r->sector + i, p);
+          }
+      sema_up (&r->done);
+    }
+}
+
+/* Waits for request R, previously passed to block_submit(), to
+   complete. */
+void
+block_wait (struct block_request *r)
+{
+  sema_down (&r->done);
 }
 
 /* Returns the number of sectors in BLOCK. */
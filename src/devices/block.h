@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,9 +56,34 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, block_sector_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, block_sector_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* An asynchronous transfer of CNT consecutive sectors between a
+   block device and memory.  Submit with block_submit(), then wait
+   for completion with block_wait().  A driver may reorder and
+   merge requests that are outstanding at the same time, so
+   overlapping requests must not be outstanding together. */
+struct block_request
+  {
+    struct list_elem elem;      /* For use by the driver. */
+    void *aux;                  /* For use by the driver. */
+    bool write;                 /* True to write, false to read. */
+    block_sector_t sector;      /* First sector. */
+    block_sector_t cnt;         /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE kernel bytes. */
+    struct semaphore done;      /* Up'd when the transfer completes. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, block_sector_t cnt, void *buffer);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,6 +93,21 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors in a single
+       operation.  If null, the block layer calls read or write
+       once per sector instead. */
+    void (*read_multiple) (void *aux, block_sector_t, block_sector_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, block_sector_t cnt,
+                            const void *buffer);
+
+    /* Optional.  Queues request R and returns, possibly before the
+       transfer completes, then ups R's "done" semaphore once it
+       has.  The driver may modify R's members other than "done".
+       If non-null, the other operations are never called and may
+       be null. */
+    void (*submit) (void *aux, struct block_request *r);
   };
 
 struct block *block_register (const char *name, enum block_type,
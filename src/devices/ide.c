@@ -3,15 +3,35 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/block.h"
 #include "devices/partition.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Data moves by programmed I/O (PIO) unless the "-dma" option
+   is given.  In that case, if a PCI IDE controller with
+   bus-master support (such as the PIIX emulated by QEMU and
+   Bochs) is found, transfers to disks that support DMA are
+   instead done by the controller itself, following the
+   "Programming Interface for Bus Master IDE Controller"
+   specification.
+
+   Requests are not carried out by the threads that submit them.
+   Instead, each channel keeps a queue of pending requests, which
+   a dispatcher thread serves in C-LOOK elevator order: in
+   ascending sector order starting from the current head
+   position, jumping back to the lowest pending sector after the
+   highest.  Queued requests for consecutive sectors in the same
+   direction are merged into a single command. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +54,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +70,51 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA_RETRY 0xc8         /* READ DMA with retries. */
+#define CMD_WRITE_DMA_RETRY 0xca        /* WRITE DMA with retries. */
+
+/* Bus master IDE port addresses, relative to a channel's
+   bus master base. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start/stop transfer. */
+#define BM_CMD_READ 0x08        /* 1=write to memory, 0=read memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_IRQ 0x04         /* Interrupt (write 1 to clear). */
+#define BM_STA_ERR 0x02         /* Error (write 1 to clear). */
+
+/* Physical Region Descriptor, which describes one physically
+   contiguous memory buffer for a DMA transfer.  The buffer may
+   not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address of buffer. */
+    uint16_t size;              /* Size in bytes (0 means 64 kB). */
+    uint16_t flags;             /* PRD_EOT or 0. */
+  };
+#define PRD_EOT 0x8000          /* Last descriptor in the table. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))  /* PRDs in a table. */
+#define PRD_BOUNDARY 0x10000    /* PRD buffers may not cross this. */
+
+/* DMA normally moves data directly to and from the requests' own
+   buffers.  Buffers that the bus master cannot address, because
+   they are not word-aligned, go through the channel's DMA buffer
+   instead.  It is DMA_PAGES pages long, one PRD per page, which
+   bounds the sectors moved by one such DMA command. */
+#define DMA_PAGES 8
+#define DMA_MAX_SECTORS (DMA_PAGES * PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* PCI configuration space access ports.  See [PCI]. */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Most sectors a single READ or WRITE SECTOR command can
+   transfer.  A sector count register value of 0 means 256. */
+#define MAX_SECTORS_PER_CMD 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +123,7 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool use_dma;               /* Transfer data by bus-master DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +139,15 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    struct lock queue_lock;     /* Protects queue and head. */
+    struct condition queue_not_empty;   /* Signaled when queue gains work. */
+    struct list queue;          /* Pending block_requests, by request_key. */
+    uint32_t head;              /* request_key just past last dispatch. */
+
+    uint16_t bm_base;           /* Bus master base I/O port, 0 if none. */
+    struct prd *prdt;           /* PRD table, if bm_base != 0. */
+    uint8_t *dma_buffer;        /* DMA_PAGES pages, if bm_base != 0. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -79,13 +155,34 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* Use bus-master DMA?  Set by the "-dma" option. */
+bool ide_dma;
+
+/* Position within the buffers of a batch of requests. */
+struct batch_cursor
+  {
+    struct list_elem *e;        /* Current request's elem. */
+    block_sector_t ofs;         /* Sector offset within current request. */
+  };
+
 static struct block_operations ide_operations;
 
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static uint16_t find_bus_master (void);
+static void init_dma (struct channel *, uint16_t bm_base);
+static bool dma_map_requests (struct channel *, struct batch_cursor,
+                              block_sector_t cnt);
+static void dma_map_buffer (struct channel *, block_sector_t cnt);
+static bool dma_transfer (struct ata_disk *, block_sector_t, block_sector_t cnt,
+                          bool write);
+
+static void dispatcher (void *channel_);
+
+static void select_sector (struct ata_disk *, block_sector_t,
+                           block_sector_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -101,8 +198,12 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = ide_dma ? find_bus_master () : 0;
   size_t chan_no;
 
+  if (ide_dma && bm_base == 0)
+    printf ("ide: no bus master IDE controller, using PIO\n");
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -126,6 +227,11 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      lock_init (&c->queue_lock);
+      cond_init (&c->queue_not_empty);
+      list_init (&c->queue);
+      c->head = 0;
+      init_dma (c, bm_base != 0 ? bm_base + 8 * chan_no : 0);
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +242,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->use_dma = false;
         }
 
       /* Register interrupt handler. */
@@ -148,6 +255,11 @@ ide_init (void)
       if (check_device_type (&c->devices[0]))
         check_device_type (&c->devices[1]);
 
+      /* Start serving requests.  Identification below may
+         already submit some, to scan for partitions. */
+      if (c->devices[0].is_ata || c->devices[1].is_ata)
+        thread_create (c->name, PRI_DEFAULT, dispatcher, c);
+
       /* Read hard disk identity information. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
@@ -281,13 +393,16 @@ identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
-  /* Calculate capacity.
+  /* Calculate capacity and check for DMA support (word 49,
+     bit 8).
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  d->use_dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            d->use_dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -337,63 +452,247 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+/* Request queuing. */
+
+/* Returns the position of request R in the elevator's sweep order,
+   which sorts the master's sectors before the slave's. */
+static uint32_t
+request_key (const struct block_request *r)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  const struct ata_disk *d = r->aux;
+  return ((uint32_t) d->dev_no << 28) | r->sector;
+}
+
+/* Returns true if request A_ precedes request B_ in sweep
+   order. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+  return request_key (a) < request_key (b);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Queues request R for disk D and returns without waiting for it
+   to complete.  The channel's dispatcher ups R's "done" semaphore
+   once the transfer is finished. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_submit (void *d_, struct block_request *r)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+
+  ASSERT (r->sector + r->cnt <= (1UL << 28));
+
+  r->aux = d;
+  lock_acquire (&c->queue_lock);
+  list_insert_ordered (&c->queue, &r->elem, request_less, NULL);
+  cond_signal (&c->queue_not_empty, &c->queue_lock);
+  lock_release (&c->queue_lock);
 }
 
 static struct block_operations ide_operations =
   {
-    ide_read,
-    ide_write
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    ide_submit
   };
-
+
+/* Moves the next batch of requests to serve from channel C's
+   queue, which must not be empty, to BATCH, and returns the total
+   number of sectors in the batch.  The batch starts with the
+   first request at or past the head position in sweep order, or
+   the first request overall if there is none.  It continues with
+   following requests that pick up where the previous one left
+   off on the same disk in the same direction, up to
+   MAX_SECTORS_PER_CMD sectors. */
+static block_sector_t
+take_batch (struct channel *c, struct list *batch)
+{
+  struct block_request *first;
+  struct list_elem *e;
+  block_sector_t cnt;
+
+  ASSERT (lock_held_by_current_thread (&c->queue_lock));
+  ASSERT (!list_empty (&c->queue));
+
+  for (e = list_begin (&c->queue); e != list_end (&c->queue);
+       e = list_next (e))
+    if (request_key (list_entry (e, struct block_request, elem)) >= c->head)
+      break;
+  if (e == list_end (&c->queue))
+    e = list_begin (&c->queue);
+
+  first = list_entry (e, struct block_request, elem);
+  e = list_remove (e);
+  list_push_back (batch, &first->elem);
+  cnt = first->cnt;
+
+  while (e != list_end (&c->queue))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->aux != first->aux || r->write != first->write
+          || r->sector != first->sector + cnt
+          || cnt + r->cnt > MAX_SECTORS_PER_CMD)
+        break;
+      e = list_remove (e);
+      list_push_back (batch, &r->elem);
+      cnt += r->cnt;
+    }
+
+  c->head = request_key (first) + cnt;
+  return cnt;
+}
+
+/* Returns the buffer for the sector at CUR and advances CUR to the
+   following sector. */
+static uint8_t *
+next_sector (struct batch_cursor *cur)
+{
+  struct block_request *r = list_entry (cur->e, struct block_request, elem);
+  uint8_t *p = (uint8_t *) r->buffer + cur->ofs * BLOCK_SECTOR_SIZE;
+
+  if (++cur->ofs >= r->cnt)
+    {
+      cur->e = list_next (cur->e);
+      cur->ofs = 0;
+    }
+  return p;
+}
+
+/* Transfers the CNT sectors starting at SEC_NO on disk D to or
+   from the buffers at CUR, to the disk if WRITE is true, from it
+   otherwise.  Each command moves up to MAX_SECTORS_PER_CMD
+   sectors.  With DMA, the bus master moves them directly to or
+   from the buffers if it can, or else at most DMA_MAX_SECTORS of
+   them through the channel's DMA buffer.  With PIO, the disk
+   interrupts once per sector.  The channel's lock must be held. */
+static void
+transfer (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt,
+          bool write, struct batch_cursor *cur)
+{
+  struct channel *c = d->channel;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  while (cnt > 0)
+    {
+      block_sector_t chunk = cnt < MAX_SECTORS_PER_CMD
+                             ? cnt : MAX_SECTORS_PER_CMD;
+      block_sector_t i;
+
+      if (d->use_dma)
+        {
+          struct batch_cursor start = *cur;
+          bool direct = dma_map_requests (c, *cur, chunk);
+
+          if (!direct)
+            {
+              if (chunk > DMA_MAX_SECTORS)
+                chunk = DMA_MAX_SECTORS;
+              dma_map_buffer (c, chunk);
+              if (write)
+                for (i = 0; i < chunk; i++)
+                  memcpy (c->dma_buffer + i * BLOCK_SECTOR_SIZE,
+                          next_sector (cur), BLOCK_SECTOR_SIZE);
+            }
+          if (dma_transfer (d, sec_no, chunk, write))
+            {
+              if (direct)
+                for (i = 0; i < chunk; i++)
+                  next_sector (cur);
+              else if (!write)
+                for (i = 0; i < chunk; i++)
+                  memcpy (next_sector (cur),
+                          c->dma_buffer + i * BLOCK_SECTOR_SIZE,
+                          BLOCK_SECTOR_SIZE);
+              sec_no += chunk;
+              cnt -= chunk;
+              continue;
+            }
+          *cur = start;
+        }
+
+      select_sector (d, sec_no, chunk);
+      issue_pio_command (c, write ? CMD_WRITE_SECTOR_RETRY
+                                  : CMD_READ_SECTOR_RETRY);
+      for (i = 0; i < chunk; i++)
+        if (write)
+          {
+            if (!wait_while_busy (d))
+              PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                     d->name, sec_no + i);
+            output_sector (c, next_sector (cur));
+            sema_down (&c->completion_wait);
+          }
+        else
+          {
+            sema_down (&c->completion_wait);
+            if (!wait_while_busy (d))
+              PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                     d->name, sec_no + i);
+            input_sector (c, next_sector (cur));
+          }
+      sec_no += chunk;
+      cnt -= chunk;
+    }
+}
+
+/* Dispatcher thread for channel CHANNEL_.  Repeatedly takes a
+   batch of requests from the channel's queue, carries it out, and
+   wakes up the requests' submitters. */
+static void
+dispatcher (void *channel_)
+{
+  struct channel *c = channel_;
+
+  for (;;)
+    {
+      struct block_request *first;
+      struct batch_cursor cur;
+      struct list batch;
+      block_sector_t cnt;
+
+      list_init (&batch);
+      lock_acquire (&c->queue_lock);
+      while (list_empty (&c->queue))
+        cond_wait (&c->queue_not_empty, &c->queue_lock);
+      cnt = take_batch (c, &batch);
+      lock_release (&c->queue_lock);
+
+      first = list_entry (list_front (&batch), struct block_request, elem);
+      cur.e = list_begin (&batch);
+      cur.ofs = 0;
+      lock_acquire (&c->lock);
+      transfer (first->aux, first->sector, cnt, first->write, &cur);
+      lock_release (&c->lock);
+
+      /* A request may be freed as soon as its "done" is up'd. */
+      while (!list_empty (&batch))
+        {
+          struct block_request *r = list_entry (list_pop_front (&batch),
+                                                struct block_request, elem);
+          sema_up (&r->done);
+        }
+    }
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_SECTORS_PER_CMD);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTORS_PER_CMD ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -402,7 +701,8 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+   completion interrupt.  Used for DMA commands as well as PIO
+   ones. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) 
 {
@@ -430,6 +730,211 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Bus-master DMA. */
+
+/* Reads the 32-bit register REG from the configuration space of
+   PCI function FUNC of device DEV on bus BUS. */
+static uint32_t
+pci_read_config (int bus, int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDRESS, (0x80000000 | (bus << 16) | (dev << 11)
+                             | (func << 8) | (reg & 0xfc)));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes DATA to the 32-bit register REG in the configuration
+   space of PCI function FUNC of device DEV on bus BUS. */
+static void
+pci_write_config (int bus, int dev, int func, int reg, uint32_t data)
+{
+  outl (PCI_CONFIG_ADDRESS, (0x80000000 | (bus << 16) | (dev << 11)
+                             | (func << 8) | (reg & 0xfc)));
+  outl (PCI_CONFIG_DATA, data);
+}
+
+/* Searches PCI bus 0 for an IDE controller capable of bus
+   mastering, enables bus mastering on it, and returns the base
+   I/O port of its bus master registers.  Returns 0 if there is
+   no such controller. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t id = pci_read_config (0, dev, func, 0x00);
+        uint32_t class = pci_read_config (0, dev, func, 0x08);
+        uint32_t bar4;
+
+        if ((id & 0xffff) == 0xffff)
+          continue;
+
+        /* Class 01h (mass storage), subclass 01h (IDE), with
+           programming interface bit 7 (bus master) set. */
+        if ((class >> 16) != 0x0101 || (class & 0x8000) == 0)
+          continue;
+
+        /* BAR4 must be an I/O space address. */
+        bar4 = pci_read_config (0, dev, func, 0x20);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space and bus mastering in the Command
+           register. */
+        pci_write_config (0, dev, func, 0x04,
+                          pci_read_config (0, dev, func, 0x04) | 0x05);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
+/* Sets up channel C to do DMA through the bus master registers
+   at BM_BASE, or to do only PIO if BM_BASE is 0. */
+static void
+init_dma (struct channel *c, uint16_t bm_base)
+{
+  c->bm_base = 0;
+  c->prdt = NULL;
+  c->dma_buffer = NULL;
+  if (bm_base == 0)
+    return;
+
+  /* The PRD table must not cross a 64 kB boundary, which a page
+     never does. */
+  c->prdt = palloc_get_page (0);
+  c->dma_buffer = palloc_get_multiple (0, DMA_PAGES);
+  if (c->prdt == NULL || c->dma_buffer == NULL)
+    {
+      printf ("%s: out of memory for DMA, using PIO\n", c->name);
+      palloc_free_page (c->prdt);
+      palloc_free_multiple (c->dma_buffer, DMA_PAGES);
+      c->prdt = NULL;
+      c->dma_buffer = NULL;
+      return;
+    }
+  c->bm_base = bm_base;
+  outb (reg_bm_command (c), 0);
+}
+
+/* Fills in channel C's PRD table to describe the buffers for the
+   CNT sectors at CUR, so that the bus master can move data to and
+   from them directly.  The kernel maps physical memory linearly,
+   so each buffer is physically contiguous; consecutive buffers
+   that happen to be adjacent share a PRD.  Returns false without
+   a usable table if some buffer is not word-aligned, as the bus
+   master requires. */
+static bool
+dma_map_requests (struct channel *c, struct batch_cursor cur,
+                  block_sector_t cnt)
+{
+  size_t n = 0;
+  block_sector_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      uint8_t *buffer = next_sector (&cur);
+      uintptr_t addr;
+      size_t left;
+
+      if ((uintptr_t) buffer % 2 != 0)
+        return false;
+
+      /* A PRD may not cross a 64 kB boundary, so a sector that
+         straddles one takes two. */
+      addr = vtop (buffer);
+      for (left = BLOCK_SECTOR_SIZE; left > 0; )
+        {
+          size_t size = PRD_BOUNDARY - addr % PRD_BOUNDARY;
+          if (size > left)
+            size = left;
+
+          if (n > 0 && c->prdt[n - 1].addr + c->prdt[n - 1].size == addr
+              && addr % PRD_BOUNDARY != 0)
+            c->prdt[n - 1].size += size;
+          else if (n < PRD_CNT)
+            {
+              c->prdt[n].addr = addr;
+              c->prdt[n].size = size;
+              c->prdt[n].flags = 0;
+              n++;
+            }
+          else
+            return false;
+          addr += size;
+          left -= size;
+        }
+    }
+  c->prdt[n - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* Fills in channel C's PRD table to describe the first CNT
+   sectors of its DMA buffer, one page per PRD. */
+static void
+dma_map_buffer (struct channel *c, block_sector_t cnt)
+{
+  size_t bytes = cnt * BLOCK_SECTOR_SIZE;
+  size_t i;
+
+  ASSERT (cnt >= 1 && cnt <= DMA_MAX_SECTORS);
+
+  for (i = 0; bytes > 0; i++)
+    {
+      size_t size = bytes < PGSIZE ? bytes : PGSIZE;
+      c->prdt[i].addr = vtop (c->dma_buffer + i * PGSIZE);
+      c->prdt[i].size = size;
+      c->prdt[i].flags = 0;
+      bytes -= size;
+    }
+  c->prdt[i - 1].flags = PRD_EOT;
+}
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D and
+   the memory described by its channel's PRD table, from disk to
+   memory if WRITE is false, from memory to disk if it is true.
+   The channel's lock must be held.  Returns true if successful.
+   On failure, turns off DMA for D and returns false, so that the
+   caller can retry with PIO. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt,
+              bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t bm_status;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (cnt >= 1 && cnt <= MAX_SECTORS_PER_CMD);
+
+  /* Program the bus master, clearing stale interrupt and error
+     status, then the disk, then start the transfer. */
+  outb (reg_bm_command (c), 0);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_STA_IRQ | BM_STA_ERR);
+  outb (reg_bm_command (c), write ? 0 : BM_CMD_READ);
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA_RETRY : CMD_READ_DMA_RETRY);
+  outb (reg_bm_command (c), inb (reg_bm_command (c)) | BM_CMD_START);
+
+  /* Wait for the completion interrupt, then stop the bus master
+     and acknowledge its status. */
+  sema_down (&c->completion_wait);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_command (c), inb (reg_bm_command (c)) & ~BM_CMD_START);
+  outb (reg_bm_status (c), bm_status | BM_STA_IRQ | BM_STA_ERR);
+
+  if ((bm_status & BM_STA_ERR) != 0
+      || (inb (reg_alt_status (c)) & (STA_BSY | STA_ERR)) != 0)
+    {
+      printf ("%s: DMA %s failed, sector=%"PRDSNu", using PIO\n",
+              d->name, write ? "write" : "read", sec_no);
+      d->use_dma = false;
+      return false;
+    }
+  return true;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +78,49 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Configures CHANNEL, which must be channel 0, to raise its
+   interrupt once, after COUNT PIT cycles, and then stay quiet
+   until it is configured again.  This is mode 0, "interrupt on terminal
+   count".  A COUNT of 0 means 65536. */
+void
+pit_start_oneshot (int channel, uint16_t count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the current value of CHANNEL's counter, which counts
+   down by one every PIT cycle, and stores the state of the
+   channel's output in *OUTPUT.  In mode 0, the output goes high
+   when the count runs out and stays high, whereas the counter
+   wraps around and keeps counting down.
+
+   Uses the read-back command to latch the counter and status
+   together, so that they are consistent with each other. */
+uint16_t
+pit_read_counter (int channel, bool *output)
+{
+  enum intr_level old_level;
+  uint8_t status;
+  uint16_t count;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0xc0 | (2 << channel));
+  status = inb (PIT_PORT_COUNTER (channel));
+  count = inb (PIT_PORT_COUNTER (channel));
+  count |= inb (PIT_PORT_COUNTER (channel)) << 8;
+  intr_set_level (old_level);
+
+  *output = (status & 0x80) != 0;
+  return count;
+}
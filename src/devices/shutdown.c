@@ -5,6 +5,7 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
@@ -126,6 +127,7 @@ print_stats (void)
 #endif
   console_print_stats ();
   kbd_print_stats ();
+  slab_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
 #endif
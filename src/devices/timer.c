@@ -20,11 +20,46 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* PIT cycles per timer tick. */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* If true, stop the periodic timer interrupt while idle.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* One-shot mode.
+
+   While the idle thread halts, the PIT is set to interrupt just
+   once, at the next tick on which something has to happen,
+   instead of on every tick.  Ticks that pass in the meantime are
+   counted when that interrupt arrives, or when the idle thread
+   is switched out.
+
+   If oneshot_ticks is 0, the PIT is in its usual periodic mode.
+   Otherwise, oneshot_done ticks had passed, but were not yet
+   added to `ticks', when the PIT was loaded with oneshot_count
+   cycles.  The first tick after that is oneshot_first cycles
+   later, and the rest follow every TICK_CYCLES cycles, up to
+   oneshot_ticks in all, the last of which raises the
+   interrupt. */
+static int64_t oneshot_ticks;
+static int64_t oneshot_done;
+static unsigned oneshot_count;
+static unsigned oneshot_first;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Threads blocked in timer_sleep(), in order of wake_tick.
+   Protected by disabling interrupts, since timer_interrupt()
+   wakes them. */
+static struct list sleep_list;
+
 static intr_handler_func timer_interrupt;
+static list_less_func wakes_earlier;
+static int64_t oneshot_passed (unsigned counter, bool expired);
+static void oneshot_start (int64_t max_ticks);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -37,6 +72,7 @@ timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+  list_init (&sleep_list);
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -72,10 +108,59 @@ timer_ticks (void)
 {
   enum intr_level old_level = intr_disable ();
   int64_t t = ticks;
+  if (oneshot_ticks != 0)
+    {
+      bool expired;
+      unsigned counter = pit_read_counter (0, &expired);
+      t += oneshot_done + oneshot_passed (counter, expired);
+    }
   intr_set_level (old_level);
   return t;
 }
 
+/* Called by the idle thread, with interrupts off, just before
+   it halts the CPU.  If tickless operation is enabled, stops
+   the periodic timer interrupt until the next tick on which a
+   sleeping thread wakes up or, with the multi-level feedback
+   queue scheduler, the load average is due to be updated.
+
+   The PIT's counter is only 16 bits wide, so the interrupt
+   cannot be put off for longer than about 55 ms. */
+void
+timer_idle_enter (void) 
+{
+  int64_t now, max_ticks = INT64_MAX;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless)
+    return;
+
+  now = timer_ticks ();
+  if (!list_empty (&sleep_list))
+    {
+      struct thread *t = list_entry (list_front (&sleep_list),
+                                     struct thread, elem);
+      max_ticks = t->wake_tick - now;
+    }
+  if (thread_mlfqs && max_ticks > TIMER_FREQ - now % TIMER_FREQ)
+    max_ticks = TIMER_FREQ - now % TIMER_FREQ;
+  oneshot_start (max_ticks);
+}
+
+/* Called with interrupts off when the idle thread is switched
+   out.  Goes back to interrupting on every tick, starting with
+   the next one, so that the thread that runs next gets its time
+   slice enforced. */
+void
+timer_idle_exit (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (oneshot_ticks != 0)
+    oneshot_start (1);
+}
+
 /* Returns the number of timer ticks elapsed since THEN, which
    should be a value once returned by timer_ticks(). */
 int64_t
@@ -85,15 +170,26 @@ timer_elapsed (int64_t then)
 }
 
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.
+
+   The thread blocks on sleep_list until timer_interrupt() wakes
+   it, rather than yielding over and over, so that sleeping takes
+   no CPU time. */
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable ();
+  cur->wake_tick = timer_ticks () + ticks;
+  list_insert_ordered (&sleep_list, &cur->elem, wakes_earlier, NULL);
+  thread_block ();
+  intr_set_level (old_level);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -170,8 +266,119 @@ timer_print_stats (void)
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
-  thread_tick ();
+  int64_t elapsed = 1;
+
+  /* At the end of a one-shot interval, go back to periodic mode
+     and catch up on the ticks that passed. */
+  if (oneshot_ticks != 0)
+    {
+      elapsed = oneshot_ticks;
+      oneshot_ticks = 0;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+    }
+
+  while (elapsed-- > 0)
+    {
+      ticks++;
+
+      /* Wake up threads whose sleep has ended. */
+      while (!list_empty (&sleep_list))
+        {
+          struct thread *t = list_entry (list_front (&sleep_list),
+                                         struct thread, elem);
+          if (t->wake_tick > ticks)
+            break;
+          list_pop_front (&sleep_list);
+          thread_unblock (t);
+        }
+
+      thread_tick ();
+    }
+}
+
+/* Returns the number of ticks that have passed since the PIT was
+   last loaded in one-shot mode, given the current value COUNTER
+   of its counter and whether its output shows that the count has
+   EXPIRED.  Interrupts must be off.
+
+   Once the count runs out, the counter wraps around and keeps
+   counting down, so it says nothing about the time after that,
+   but the output stays high until the PIT is reprogrammed. */
+static int64_t
+oneshot_passed (unsigned counter, bool expired) 
+{
+  int64_t total = oneshot_ticks - oneshot_done;
+  unsigned elapsed, passed;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (expired || counter == 0 || counter > oneshot_count)
+    return total;
+  elapsed = oneshot_count - counter;
+  if (elapsed < oneshot_first)
+    return 0;
+  passed = 1 + (elapsed - oneshot_first) / TICK_CYCLES;
+  return passed < total ? passed : total;
+}
+
+/* Loads the PIT to interrupt once, at the next tick or up to
+   MAX_TICKS - 1 ticks after that, as far as its 16-bit counter
+   allows, keeping ticks in step with those of periodic mode.
+   Does nothing if a one-shot interval has already run out, since
+   its interrupt is then pending.  Interrupts must be off. */
+static void
+oneshot_start (int64_t max_ticks) 
+{
+  int64_t done = 0, n;
+  unsigned first;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (oneshot_ticks == 0)
+    {
+      /* In periodic mode, the counter is the number of cycles
+         to the next tick. */
+      bool output;
+
+      first = pit_read_counter (0, &output);
+      if (first == 0 || first > TICK_CYCLES)
+        first = TICK_CYCLES;
+    }
+  else
+    {
+      bool expired;
+      unsigned counter = pit_read_counter (0, &expired);
+      int64_t passed = oneshot_passed (counter, expired);
+
+      if (oneshot_done + passed >= oneshot_ticks)
+        return;
+
+      /* Start from the next tick of the interval in progress. */
+      done = oneshot_done + passed;
+      first = oneshot_first + passed * TICK_CYCLES
+              - (oneshot_count - counter);
+    }
+
+  n = (UINT16_MAX - first) / TICK_CYCLES + 1;
+  if (max_ticks < n)
+    n = max_ticks > 1 ? max_ticks : 1;
+
+  oneshot_done = done;
+  oneshot_ticks = done + n;
+  oneshot_first = first;
+  oneshot_count = first + (n - 1) * TICK_CYCLES;
+  pit_start_oneshot (0, oneshot_count);
+}
+
+/* Returns true if the thread that contains A_ wakes up before
+   the one that contains B_. */
+static bool
+wakes_earlier (const struct list_elem *a_, const struct list_elem *b_,
+               void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+  return a->wake_tick < b->wake_tick;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
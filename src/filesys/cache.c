@@ -0,0 +1,517 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Buffer cache.
+
+   Keeps the CACHE_SIZE most recently used sectors of the file
+   system device in memory, so that repeated accesses to hot
+   sectors (the root directory, the free map, inodes) become
+   memory copies instead of disk transfers.  Writes go into the
+   cache and reach the disk only when a dirty entry is evicted
+   or the cache is flushed.
+
+   Eviction uses the clock algorithm: each entry has an
+   `accessed' bit that is set on every use and cleared as the
+   clock hand sweeps past it; the first unpinned entry found with
+   a clear bit is the victim.
+
+   Locking is two-level.  CACHE_LOCK protects the mapping from
+   entries to sectors, the pin counts, and the clock hand.  Each
+   entry's own LOCK protects its data and dirty bit, so that
+   copies into and out of different entries proceed in
+   parallel.  An entry with a nonzero pin count is in use or
+   about to be used and may not be evicted.
+
+   Sequential readers can ask for sectors they will need soon
+   with cache_readahead().  Those sectors are queued for a
+   background "readahead" thread, which brings them into the
+   cache while the reader is busy copying the current sector.
+   Readers of whole sectors use cache_read_multiple() instead,
+   which bypasses the cache, so they should not read ahead. */
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, if IN_USE. */
+    bool in_use;                        /* Holds a sector? */
+    bool dirty;                         /* Modified since read? */
+    bool accessed;                      /* Used since last clock sweep? */
+    int pin_cnt;                        /* Number of users and waiters. */
+    struct lock lock;                   /* Guards DATA and DIRTY. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;          /* Guards sector mapping, pins. */
+static size_t clock_hand;               /* Next entry to examine. */
+
+/* Timer ticks between flushes by the write-behind thread. */
+#define WRITE_BEHIND_PERIOD TIMER_FREQ
+
+/* Set by cache_done() to stop the write-behind thread. */
+static bool writebehind_stop;
+
+/* Most sectors written back by one multi-sector transfer. */
+#define FLUSH_BATCH 16
+static uint8_t flush_buffer[FLUSH_BATCH * BLOCK_SECTOR_SIZE];
+static struct lock flush_lock;          /* Serializes cache_flush(). */
+
+/* Most sectors read by one multi-sector transfer into a user
+   buffer.  The block driver may run the transfer in another
+   thread, which cannot access user memory, so such reads go
+   through READ_BUFFER. */
+#define READ_BATCH 16
+static uint8_t read_buffer[READ_BATCH * BLOCK_SECTOR_SIZE];
+static struct lock read_lock;           /* Guards READ_BUFFER. */
+
+/* Read-ahead queue, a ring of sectors waiting to be fetched. */
+#define READAHEAD_QUEUE_SIZE 32
+static block_sector_t readahead_queue[READAHEAD_QUEUE_SIZE];
+static size_t readahead_head;           /* Next sector to fetch. */
+static size_t readahead_cnt;            /* Number of queued sectors. */
+static struct lock readahead_lock;      /* Guards the queue. */
+static struct semaphore readahead_sema; /* Up'd once per queued sector. */
+
+static thread_func readahead_daemon NO_RETURN;
+static thread_func writebehind_daemon;
+static void flush_run (struct cache_entry **, size_t cnt);
+static void read_direct (block_sector_t, block_sector_t cnt, uint8_t *);
+static struct cache_entry *cache_get (block_sector_t, bool load);
+static void cache_put (struct cache_entry *);
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_evict (void);
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      e->in_use = false;
+      e->dirty = false;
+      e->accessed = false;
+      e->pin_cnt = 0;
+      lock_init (&e->lock);
+    }
+  clock_hand = 0;
+  lock_init (&flush_lock);
+  lock_init (&read_lock);
+
+  lock_init (&readahead_lock);
+  sema_init (&readahead_sema, 0);
+  readahead_head = readahead_cnt = 0;
+  writebehind_stop = false;
+  thread_create ("readahead", PRI_DEFAULT, readahead_daemon, NULL);
+  thread_create ("writebehind", PRI_DEFAULT, writebehind_daemon, NULL);
+}
+
+/* Shuts down the buffer cache, writing all dirty sectors back to
+   disk.  Stops the write-behind thread first, so that the flush
+   here is the last one.  A periodic flush already under way
+   finishes first, because flushes are serialized. */
+void
+cache_done (void)
+{
+  writebehind_stop = true;
+  cache_flush ();
+}
+
+/* Writes every dirty sector in the cache back to disk.
+
+   The dirty entries are written in ascending sector order, so
+   that the disk head sweeps across the disk once, and runs of
+   adjacent sectors are handed to flush_run() together. */
+void
+cache_flush (void)
+{
+  struct cache_entry *dirty[CACHE_SIZE];
+  size_t dirty_cnt = 0;
+  size_t i, j;
+
+  lock_acquire (&flush_lock);
+
+  /* Pin every dirty entry, keeping the list sorted by sector.
+     Pinned entries cannot be evicted, so their sectors stay
+     put until we are done. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (!e->in_use || !e->dirty)
+        continue;
+
+      e->pin_cnt++;
+      for (j = dirty_cnt++; j > 0 && dirty[j - 1]->sector > e->sector; j--)
+        dirty[j] = dirty[j - 1];
+      dirty[j] = e;
+    }
+  lock_release (&cache_lock);
+
+  /* Write out runs of consecutive sectors. */
+  for (i = 0; i < dirty_cnt; i = j)
+    {
+      for (j = i + 1; j < dirty_cnt; j++)
+        if (dirty[j]->sector != dirty[j - 1]->sector + 1)
+          break;
+      flush_run (dirty + i, j - i);
+    }
+
+  lock_release (&flush_lock);
+}
+
+/* Writes the CNT pinned cache entries in RUN, which hold
+   consecutive sectors, back to disk with as few multi-sector
+   transfers as possible, and unpins them.  FLUSH_LOCK must be
+   held.
+
+   Each entry's data is copied into FLUSH_BUFFER and marked clean
+   under the entry's lock, which is then released before the
+   disk write, so writers to the entry only wait for the copy.
+   If such a writer dirties the entry again, it will simply be
+   written again by a later flush. */
+static void
+flush_run (struct cache_entry **run, size_t cnt)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&flush_lock));
+
+  while (cnt > 0)
+    {
+      size_t batch = cnt < FLUSH_BATCH ? cnt : FLUSH_BATCH;
+
+      for (i = 0; i < batch; i++)
+        {
+          struct cache_entry *e = run[i];
+
+          lock_acquire (&e->lock);
+          memcpy (flush_buffer + i * BLOCK_SECTOR_SIZE, e->data,
+                  BLOCK_SECTOR_SIZE);
+          e->dirty = false;
+          lock_release (&e->lock);
+        }
+      block_write_multiple (fs_device, run[0]->sector, batch, flush_buffer);
+
+      for (i = 0; i < batch; i++)
+        {
+          lock_acquire (&cache_lock);
+          run[i]->pin_cnt--;
+          lock_release (&cache_lock);
+        }
+      run += batch;
+      cnt -= batch;
+    }
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER into sector
+   SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within sector
+   SECTOR into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER into sector SECTOR, starting at
+   byte offset OFS within the sector.  If the whole sector is
+   overwritten, it is not read from disk first. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, ofs != 0 || size != BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Sectors that are cached are copied from the cache.
+   Each run of sectors that are not is read from disk into
+   BUFFER with read_direct(), without being added to the cache,
+   so that a large sequential read does not flush out the hot
+   sectors.  For the same reason, callers should not queue the
+   sectors that follow for read-ahead. */
+void
+cache_read_multiple (block_sector_t sector, block_sector_t cnt,
+                     void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+  block_sector_t i = 0;
+
+  while (i < cnt)
+    {
+      struct cache_entry *e;
+      block_sector_t run;
+
+      lock_acquire (&cache_lock);
+      e = cache_lookup (sector + i);
+      if (e != NULL)
+        {
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          e->accessed = true;
+          memcpy (buffer + i * BLOCK_SECTOR_SIZE, e->data,
+                  BLOCK_SECTOR_SIZE);
+          cache_put (e);
+          i++;
+          continue;
+        }
+
+      for (run = 1; i + run < cnt; run++)
+        if (cache_lookup (sector + i + run) != NULL)
+          break;
+      lock_release (&cache_lock);
+
+      read_direct (sector + i, run, buffer + i * BLOCK_SECTOR_SIZE);
+      i += run;
+    }
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from disk
+   into BUFFER, bypassing the cache.  A user BUFFER is filled from
+   READ_BUFFER by the current thread, READ_BATCH sectors at a
+   time, because the block driver cannot access it. */
+static void
+read_direct (block_sector_t sector, block_sector_t cnt, uint8_t *buffer)
+{
+  if (is_kernel_vaddr (buffer))
+    {
+      block_read_multiple (fs_device, sector, cnt, buffer);
+      return;
+    }
+
+  lock_acquire (&read_lock);
+  while (cnt > 0)
+    {
+      block_sector_t batch = cnt < READ_BATCH ? cnt : READ_BATCH;
+
+      block_read_multiple (fs_device, sector, batch, read_buffer);
+      memcpy (buffer, read_buffer, batch * BLOCK_SECTOR_SIZE);
+      sector += batch;
+      cnt -= batch;
+      buffer += batch * BLOCK_SECTOR_SIZE;
+    }
+  lock_release (&read_lock);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache
+   in the background.  The request is dropped if the queue is
+   full or SECTOR is already queued. */
+void
+cache_readahead (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&readahead_lock);
+  if (readahead_cnt >= READAHEAD_QUEUE_SIZE)
+    {
+      lock_release (&readahead_lock);
+      return;
+    }
+  for (i = 0; i < readahead_cnt; i++)
+    if (readahead_queue[(readahead_head + i) % READAHEAD_QUEUE_SIZE]
+        == sector)
+      {
+        lock_release (&readahead_lock);
+        return;
+      }
+  readahead_queue[(readahead_head + readahead_cnt++)
+                  % READAHEAD_QUEUE_SIZE] = sector;
+  lock_release (&readahead_lock);
+
+  sema_up (&readahead_sema);
+}
+
+/* Read-ahead thread.  Fetches queued sectors into the cache, one
+   at a time, in the order they were requested. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+
+      sema_down (&readahead_sema);
+      lock_acquire (&readahead_lock);
+      sector = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+      readahead_cnt--;
+      lock_release (&readahead_lock);
+
+      cache_put (cache_get (sector, true));
+    }
+}
+
+/* Write-behind thread.  Periodically writes dirty sectors back
+   to disk, until cache_done() stops it. */
+static void
+writebehind_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (WRITE_BEHIND_PERIOD);
+      if (writebehind_stop)
+        break;
+      cache_flush ();
+    }
+}
+
+/* Returns the cache entry for SECTOR, pinned and with its lock
+   held.  If SECTOR is not cached, an entry is evicted to make
+   room for it and, if LOAD is true, its contents are read from
+   disk; if LOAD is false, the caller must overwrite the entire
+   entry. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          /* Already cached.  Wait for any other user, including
+             a thread still reading the sector in. */
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          e->accessed = true;
+          return e;
+        }
+
+      e = cache_evict ();
+      if (e != NULL)
+        break;
+
+      /* Every entry is pinned.  Let the other users finish. */
+      lock_release (&cache_lock);
+      thread_yield ();
+      lock_acquire (&cache_lock);
+    }
+
+  /* Claim the free entry for SECTOR.  Taking its lock before
+     releasing CACHE_LOCK makes other threads that look up SECTOR
+     wait until the data is in place. */
+  e->sector = sector;
+  e->in_use = true;
+  e->dirty = false;
+  e->accessed = true;
+  e->pin_cnt = 1;
+  lock_acquire (&e->lock);
+  lock_release (&cache_lock);
+
+  if (load)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Releases entry E, obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  e->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Returns the entry that holds SECTOR, or a null pointer if
+   SECTOR is not cached.  CACHE_LOCK must be held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Chooses an unpinned entry with the clock algorithm, writes it
+   back to disk if it is dirty, and returns it, now free.
+   Returns a null pointer if every entry is pinned.
+
+   The write-back happens with CACHE_LOCK held, so that no other
+   thread can read the old sector from disk before its latest
+   contents arrive there.  CACHE_LOCK must be held. */
+static struct cache_entry *
+cache_evict (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  /* Two full sweeps clear every accessed bit, so if nothing is
+     found by then, everything is pinned. */
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (e->pin_cnt > 0)
+        continue;
+      if (!e->in_use)
+        return e;
+      if (e->accessed)
+        {
+          e->accessed = false;
+          continue;
+        }
+
+      if (e->dirty)
+        {
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+        }
+      e->in_use = false;
+      return e;
+    }
+  return NULL;
+}
@@ -1,22 +1,92 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects the free map state. */
+
+/* Second level of the free map: one bit per SUMMARY_SECTORS
+   sectors, set when all of them are allocated, so that searches
+   can skip over fully allocated regions quickly. */
+#define SUMMARY_SECTORS 32
+static struct bitmap *full_map;
+
+/* Searches start at this sector (next fit), so that they need not
+   pass over the densely allocated start of the disk every time
+   and consecutive allocations tend to be adjacent. */
+static block_sector_t next_fit;
+
+/* No run of free sectors is longer than this, as of the last
+   failed search.  Lets doomed requests fail without searching. */
+static size_t longest_free;
+
+/* Number of sectors whose bits share one free map file sector. */
+#define SECTORS_PER_MAP_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+static void update_summary (block_sector_t, size_t cnt);
+static bool write_range (block_sector_t, size_t cnt);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
-  free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  size_t sector_cnt = block_size (fs_device);
+
+  free_map = bitmap_create (sector_cnt);
+  full_map = bitmap_create (DIV_ROUND_UP (sector_cnt, SUMMARY_SECTORS));
+  if (free_map == NULL || full_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  lock_init (&free_map_lock);
+  next_fit = 0;
+  longest_free = sector_cnt;
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  update_summary (0, sector_cnt);
+}
+
+/* Returns the first sector of the first run of CNT free sectors
+   at or after START, or BITMAP_ERROR if there is none.
+
+   No free run can include a sector of a fully allocated group, so
+   the search walks the summary map one stretch of groups that are
+   not full at a time, skipping the full groups between stretches,
+   and scans the free map only within each stretch. */
+static size_t
+find_free (block_sector_t start, size_t cnt)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  size_t group_cnt = bitmap_size (full_map);
+  size_t group = start / SUMMARY_SECTORS;
+
+  while (group < group_cnt)
+    {
+      size_t end, first, last, sector;
+
+      group = bitmap_scan (full_map, group, 1, false);
+      if (group == BITMAP_ERROR)
+        break;
+      end = bitmap_scan (full_map, group, 1, true);
+      if (end == BITMAP_ERROR)
+        end = group_cnt;
+
+      first = group * SUMMARY_SECTORS;
+      if (first < start)
+        first = start;
+      last = end * SUMMARY_SECTORS;
+      if (last > sector_cnt)
+        last = sector_cnt;
+      sector = bitmap_scan_range (free_map, first, last - first, cnt, false);
+      if (sector != BITMAP_ERROR)
+        return sector;
+      group = end;
+    }
+  return BITMAP_ERROR;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,26 +97,112 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  size_t sector = BITMAP_ERROR;
+
+  lock_acquire (&free_map_lock);
+  if (cnt <= longest_free)
+    {
+      sector = find_free (next_fit, cnt);
+      if (sector == BITMAP_ERROR && next_fit > 0)
+        sector = find_free (0, cnt);
+      if (sector == BITMAP_ERROR)
+        longest_free = cnt - 1;
+    }
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      if (!write_range (sector, cnt))
+        {
+          bitmap_set_multiple (free_map, sector, cnt, false); 
+          sector = BITMAP_ERROR;
+        }
+      else
+        {
+          update_summary (sector, cnt);
+          next_fit = sector + cnt < bitmap_size (free_map) ? sector + cnt : 0;
+        }
     }
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates the CNT consecutive sectors starting at SECTOR from
+   the free map, if all of them are free.
+   Returns true if successful, false if any of the sectors was
+   not free or if the free_map file could not be written. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  if (sector + cnt <= bitmap_size (free_map)
+      && bitmap_none (free_map, sector, cnt))
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      if (!write_range (sector, cnt))
+        bitmap_set_multiple (free_map, sector, cnt, false);
+      else
+        {
+          update_summary (sector, cnt);
+          success = true;
+        }
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  update_summary (sector, cnt);
+  longest_free = bitmap_size (free_map);
+  write_range (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Recomputes the summary bits for the CNT sectors starting at
+   SECTOR. */
+static void
+update_summary (block_sector_t sector, size_t cnt)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  size_t word;
+
+  if (cnt == 0)
+    return;
+  for (word = sector / SUMMARY_SECTORS;
+       word <= (sector + cnt - 1) / SUMMARY_SECTORS; word++)
+    {
+      size_t start = word * SUMMARY_SECTORS;
+      size_t n = (sector_cnt - start < SUMMARY_SECTORS
+                  ? sector_cnt - start : SUMMARY_SECTORS);
+      bitmap_set (full_map, word, bitmap_all (free_map, start, n));
+    }
+}
+
+/* Writes the free map file sectors that hold the bits for the CNT
+   sectors starting at SECTOR, rather than the whole free map.
+   Returns true if successful or if the free map file is not open
+   yet, false on failure. */
+static bool
+write_range (block_sector_t sector, size_t cnt)
+{
+  size_t first, end;
+
+  if (free_map_file == NULL || cnt == 0)
+    return true;
+  first = ROUND_DOWN (sector, SECTORS_PER_MAP_SECTOR);
+  end = ROUND_UP (sector + cnt, SECTORS_PER_MAP_SECTOR);
+  if (end > bitmap_size (free_map))
+    end = bitmap_size (free_map);
+  return bitmap_write_range (free_map, free_map_file, first, end - first);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +214,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  update_summary (0, bitmap_size (free_map));
 }
 
 /* Writes the free map to disk and closes the free map file. */
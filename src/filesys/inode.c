@@ -1,23 +1,65 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of sectors to read ahead of a sequential reader. */
+#define READAHEAD_SECTORS 8
+
+/* A run of consecutive sectors on disk. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    block_sector_t cnt;                 /* Number of sectors. */
+  };
+
+/* Number of extents in an inode and in an indirect block. */
+#define DIRECT_EXTENTS 62
+#define INDIRECT_EXTENTS 63
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file's data is the concatenation of its extents, the first
+   DIRECT_EXTENTS of which are stored in the inode itself.  The
+   rest are stored INDIRECT_EXTENTS at a time in a chain of
+   indirect blocks. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    block_sector_t indirect;            /* First indirect block. */
+    struct extent extents[DIRECT_EXTENTS];      /* Direct extents. */
+  };
+
+/* On-disk indirect extent block.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct indirect_block
+  {
+    block_sector_t next;                /* Next indirect block. */
+    uint32_t unused;                    /* Not used. */
+    struct extent extents[INDIRECT_EXTENTS];    /* Extents. */
+  };
+
+/* An extent as kept in memory, along with its position in the
+   file. */
+struct file_extent
+  {
+    block_sector_t ofs;                 /* File sector index of first sector. */
+    block_sector_t start;               /* First disk sector. */
+    block_sector_t cnt;                 /* Number of sectors. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,40 +70,141 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Returns the number of indirect blocks needed to hold
+   EXTENT_CNT extents. */
+static inline size_t
+extents_to_indirect (size_t extent_cnt)
+{
+  return (extent_cnt > DIRECT_EXTENTS
+          ? DIV_ROUND_UP (extent_cnt - DIRECT_EXTENTS, INDIRECT_EXTENTS)
+          : 0);
+}
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    off_t next_read;                    /* Where a sequential read resumes. */
+    off_t readahead_end;                /* End of data queued for read-ahead. */
+
+    /* Extent map.  Growing the file changes these members, so
+       they are protected by LOCK, as are changes to the file's
+       length. */
+    struct lock lock;                   /* Protects the extent map. */
+    struct file_extent *extents;        /* All of the file's extents. */
+    size_t extent_cnt;                  /* Number of extents. */
+    size_t extent_cap;                  /* Number of slots in extents. */
+    block_sector_t *indirect;           /* Indirect block sectors. */
+    block_sector_t sector_cnt;          /* Number of data sectors. */
     struct inode_disk data;             /* Inode content. */
   };
 
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, and if RUN is non-null stores in *RUN the number
+   of sectors, starting from that one, that are contiguous on
+   disk.  Looks up the extent by binary search, so it takes
+   O(log n) time in the number of extents.
+   Returns -1 if INODE has no sector allocated for a byte at
+   offset POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, block_sector_t *run) 
 {
+  block_sector_t sector = -1;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  lock_acquire (&inode->lock);
+  if ((block_sector_t) (pos / BLOCK_SECTOR_SIZE) < inode->sector_cnt)
+    {
+      block_sector_t idx = pos / BLOCK_SECTOR_SIZE;
+      size_t lo = 0, hi = inode->extent_cnt;
+
+      /* Find the last extent that starts at or before IDX. */
+      while (hi - lo > 1)
+        {
+          size_t mid = lo + (hi - lo) / 2;
+          if (inode->extents[mid].ofs <= idx)
+            lo = mid;
+          else
+            hi = mid;
+        }
+
+      if (lo < inode->extent_cnt)
+        {
+          const struct file_extent *e = &inode->extents[lo];
+          ASSERT (idx >= e->ofs && idx < e->ofs + e->cnt);
+          sector = e->start + (idx - e->ofs);
+          if (run != NULL)
+            *run = e->cnt - (idx - e->ofs);
+        }
+    }
+  lock_release (&inode->lock);
+  return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+static void readahead (struct inode *, off_t);
+static bool load_extents (struct inode *);
+static bool extend (struct inode *, off_t length);
+static void release_sectors (struct inode *);
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes, each open inode's open_cnt, and
+   lookup_key. */
+static struct lock open_inodes_lock;
+
+/* Key for searching open_inodes.  A struct inode is too big to
+   put on the stack just for its sector number. */
+static struct inode lookup_key;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+static void inode_ctor (void *);
+
+/* In-memory inodes. */
+static struct slab_cache inode_cache
+  = SLAB_CACHE_INITIALIZER ("inode", struct inode, inode_ctor);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't create open inode table");
+  lock_init (&open_inodes_lock);
+}
+
+/* Constructs the in-memory inode INODE_, when its slab is
+   created. */
+static void
+inode_ctor (void *inode_)
+{
+  struct inode *inode = inode_;
+  lock_init (&inode->lock);
+}
+
+/* Returns a hash value for the inode that contains E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if the inode that contains A_ has a lower sector
+   than the one that contains B_. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
+  return a->sector < b->sector;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -73,34 +216,38 @@ bool
 inode_create (block_sector_t sector, off_t length)
 {
   struct inode_disk *disk_inode = NULL;
+  struct inode *inode;
   bool success = false;
 
   ASSERT (length >= 0);
 
-  /* If this assertion fails, the inode structure is not exactly
-     one sector in size, and you should fix that. */
+  /* If these assertions fail, the inode structure or indirect
+     block is not exactly one sector in size, and you should fix
+     that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct indirect_block) == BLOCK_SECTOR_SIZE);
 
+  /* Write an empty inode, then grow it to LENGTH. */
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
+  if (disk_inode == NULL)
+    return false;
+  disk_inode->magic = INODE_MAGIC;
+  cache_write (sector, disk_inode);
+  free (disk_inode);
+
+  inode = inode_open (sector);
+  if (inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      success = extend (inode, length);
+      if (success)
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
+          /* extend() leaves the length alone, so set it here. */
+          inode->data.length = length;
+          cache_write (inode->sector, &inode->data);
+        }
+      else
+        release_sectors (inode);
+      inode_close (inode);
     }
   return success;
 }
@@ -111,42 +258,292 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open.  The lock is held
+     until the inode is in the table, so that two threads opening
+     the same sector get the same inode. */
+  lock_acquire (&open_inodes_lock);
+  lookup_key.sector = sector;
+  e = hash_find (&open_inodes, &lookup_key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = slab_alloc (&inode_cache);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->next_read = 0;
+  inode->readahead_end = 0;
+  cache_read (inode->sector, &inode->data);
+  if (!load_extents (inode))
+    {
+      lock_release (&open_inodes_lock);
+      slab_free (&inode_cache, inode);
+      return NULL;
+    }
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
+/* Reads INODE's extents from its on-disk inode and indirect
+   blocks into its in-memory extent map.
+   Returns true if successful, false if memory allocation
+   fails. */
+static bool
+load_extents (struct inode *inode)
+{
+  size_t cnt = inode->data.extent_cnt;
+  size_t indirect_cnt = extents_to_indirect (cnt);
+  struct indirect_block *block = NULL;
+  block_sector_t ofs = 0;
+  size_t i;
+
+  inode->extent_cnt = cnt;
+  inode->extent_cap = cnt > DIRECT_EXTENTS ? cnt : DIRECT_EXTENTS;
+  inode->extents = malloc (inode->extent_cap * sizeof *inode->extents);
+  inode->indirect = malloc (indirect_cnt * sizeof *inode->indirect);
+  if (indirect_cnt > 0)
+    block = malloc (sizeof *block);
+  if (inode->extents == NULL
+      || (indirect_cnt > 0 && (inode->indirect == NULL || block == NULL)))
+    {
+      free (inode->extents);
+      free (inode->indirect);
+      free (block);
+      return false;
+    }
+
+  for (i = 0; i < cnt; i++)
+    {
+      const struct extent *e;
+
+      if (i < DIRECT_EXTENTS)
+        e = &inode->data.extents[i];
+      else
+        {
+          size_t j = (i - DIRECT_EXTENTS) % INDIRECT_EXTENTS;
+          if (j == 0)
+            {
+              size_t b = (i - DIRECT_EXTENTS) / INDIRECT_EXTENTS;
+              inode->indirect[b] = (b == 0 ? inode->data.indirect
+                                    : block->next);
+              cache_read (inode->indirect[b], block);
+            }
+          e = &block->extents[j];
+        }
+      inode->extents[i].ofs = ofs;
+      inode->extents[i].start = e->start;
+      inode->extents[i].cnt = e->cnt;
+      ofs += e->cnt;
+    }
+  inode->sector_cnt = ofs;
+  free (block);
+  return true;
+}
+
+/* Writes INODE's on-disk inode, plus each of its indirect blocks
+   that holds extent number FIRST or a later one, back to the
+   buffer cache.  INODE's lock must be held.
+   Returns true if successful, false if memory allocation
+   fails. */
+static bool
+save_extents (struct inode *inode, size_t first)
+{
+  size_t indirect_cnt = extents_to_indirect (inode->extent_cnt);
+  size_t i, b;
+
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+
+  inode->data.extent_cnt = inode->extent_cnt;
+  inode->data.indirect = indirect_cnt > 0 ? inode->indirect[0] : 0;
+  for (i = 0; i < inode->extent_cnt && i < DIRECT_EXTENTS; i++)
+    {
+      inode->data.extents[i].start = inode->extents[i].start;
+      inode->data.extents[i].cnt = inode->extents[i].cnt;
+    }
+  cache_write (inode->sector, &inode->data);
+
+  b = first > DIRECT_EXTENTS ? (first - DIRECT_EXTENTS) / INDIRECT_EXTENTS : 0;
+  if (b < indirect_cnt)
+    {
+      struct indirect_block *block = calloc (1, sizeof *block);
+      if (block == NULL)
+        return false;
+      for (; b < indirect_cnt; b++)
+        {
+          size_t base = DIRECT_EXTENTS + b * INDIRECT_EXTENTS;
+          size_t j;
+
+          memset (block, 0, sizeof *block);
+          block->next = b + 1 < indirect_cnt ? inode->indirect[b + 1] : 0;
+          for (j = 0; j < INDIRECT_EXTENTS && base + j < inode->extent_cnt;
+               j++)
+            {
+              block->extents[j].start = inode->extents[base + j].start;
+              block->extents[j].cnt = inode->extents[base + j].cnt;
+            }
+          cache_write (inode->indirect[b], block);
+        }
+      free (block);
+    }
+  return true;
+}
+
+/* Appends the CNT sectors starting at START to INODE's data,
+   merging them into the last extent if they follow it on disk.
+   INODE's lock must be held.
+   Returns true if successful, false if memory or disk allocation
+   fails. */
+static bool
+append_extent (struct inode *inode, block_sector_t start, block_sector_t cnt)
+{
+  struct file_extent *last = (inode->extent_cnt > 0
+                              ? &inode->extents[inode->extent_cnt - 1]
+                              : NULL);
+
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+
+  if (last != NULL && last->start + last->cnt == start)
+    last->cnt += cnt;
+  else
+    {
+      size_t indirect_cnt = extents_to_indirect (inode->extent_cnt);
+
+      /* Make room in memory, and on disk if this extent needs a
+         new indirect block. */
+      if (inode->extent_cnt == inode->extent_cap)
+        {
+          size_t cap = inode->extent_cap * 2;
+          struct file_extent *extents
+            = realloc (inode->extents, cap * sizeof *extents);
+          if (extents == NULL)
+            return false;
+          inode->extents = extents;
+          inode->extent_cap = cap;
+        }
+      if (extents_to_indirect (inode->extent_cnt + 1) > indirect_cnt)
+        {
+          block_sector_t *indirect
+            = realloc (inode->indirect, (indirect_cnt + 1) * sizeof *indirect);
+          if (indirect == NULL)
+            return false;
+          inode->indirect = indirect;
+          if (!free_map_allocate (1, &inode->indirect[indirect_cnt]))
+            return false;
+        }
+
+      inode->extents[inode->extent_cnt].ofs = inode->sector_cnt;
+      inode->extents[inode->extent_cnt].start = start;
+      inode->extents[inode->extent_cnt].cnt = cnt;
+      inode->extent_cnt++;
+    }
+  inode->sector_cnt += cnt;
+  return true;
+}
+
+/* Allocates and zeroes enough sectors for INODE to hold LENGTH
+   bytes, preferring to grow its last extent in place so that
+   sequentially written files stay contiguous.  Does not change
+   INODE's length.
+   Returns true if successful, false if memory or disk allocation
+   fails, in which case INODE may have gained some but not all
+   of the needed sectors. */
+static bool
+extend (struct inode *inode, off_t length)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  size_t old_extent_cnt;
+  block_sector_t old_sector_cnt;
+  bool success = true;
+
+  lock_acquire (&inode->lock);
+  old_extent_cnt = inode->extent_cnt;
+  old_sector_cnt = inode->sector_cnt;
+  while (success && inode->sector_cnt < bytes_to_sectors (length))
+    {
+      size_t need = bytes_to_sectors (length) - inode->sector_cnt;
+      block_sector_t start = 0;
+      size_t cnt;
+
+      /* Try to grow the last extent in place, then to allocate a
+         new one, asking for fewer sectors each time we fail. */
+      for (cnt = need; cnt > 0; cnt /= 2)
+        if (inode->extent_cnt > 0)
+          {
+            const struct file_extent *last
+              = &inode->extents[inode->extent_cnt - 1];
+            start = last->start + last->cnt;
+            if (free_map_allocate_at (start, cnt))
+              break;
+          }
+      if (cnt == 0)
+        for (cnt = need; cnt > 0; cnt /= 2)
+          if (free_map_allocate (cnt, &start))
+            break;
+      if (cnt == 0)
+        success = false;
+      else if (!append_extent (inode, start, cnt))
+        {
+          free_map_release (start, cnt);
+          success = false;
+        }
+      else
+        {
+          size_t i;
+          for (i = 0; i < cnt; i++)
+            cache_write (start + i, zeros);
+        }
+    }
+
+  /* Write back the extents that changed: the old last one, which
+     may have grown, and any new ones. */
+  if (inode->sector_cnt != old_sector_cnt
+      && !save_extents (inode, old_extent_cnt > 0 ? old_extent_cnt - 1 : 0))
+    success = false;
+  lock_release (&inode->lock);
+  return success;
+}
+
+/* Releases all of INODE's data sectors and indirect blocks to the
+   free map. */
+static void
+release_sectors (struct inode *inode)
+{
+  size_t i;
+
+  for (i = 0; i < inode->extent_cnt; i++)
+    free_map_release (inode->extents[i].start, inode->extents[i].cnt);
+  for (i = 0; i < extents_to_indirect (inode->extent_cnt); i++)
+    free_map_release (inode->indirect[i], 1);
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -163,25 +560,32 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
+  /* Remove from inode table if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          release_sectors (inode);
         }
 
-      free (inode); 
+      free (inode->extents);
+      free (inode->indirect);
+      slab_free (&inode_cache, inode);
     }
 }
 
@@ -196,18 +600,28 @@ inode_remove (struct inode *inode)
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+
+   A read that starts where the previous one ended is taken to be
+   part of a sequential scan, so the sectors that follow it are
+   queued for read-ahead.  Not so if the read copied whole sectors
+   with cache_read_multiple(), though, because the reads that
+   follow it most likely will too, and those bypass the cache
+   instead of using sectors read ahead into it. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  bool sequential = offset == inode->next_read;
+  bool bypassed = false;
 
   while (size > 0) 
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Disk sector to read, starting byte offset within sector,
+         sectors contiguous on disk from there. */
+      block_sector_t run;
+      block_sector_t sector_idx = byte_to_sector (inode, offset, &run);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,23 +634,23 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Read as many whole sectors as are contiguous on disk
+             with a single multi-sector transfer. */
+          if (run > (block_sector_t) (size / BLOCK_SECTOR_SIZE))
+            run = size / BLOCK_SECTOR_SIZE;
+          if (run > (block_sector_t) (inode_left / BLOCK_SECTOR_SIZE))
+            run = inode_left / BLOCK_SECTOR_SIZE;
+          cache_read_multiple (sector_idx, run, buffer + bytes_read);
+          chunk_size = run * BLOCK_SECTOR_SIZE;
+          bypassed = true;
         }
-      else 
+      else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          /* Copy the partial chunk out of the buffer cache. */
+          cache_read_at (sector_idx, buffer + bytes_read,
+                         sector_ofs, chunk_size);
         }
       
       /* Advance. */
@@ -244,35 +658,69 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  inode->next_read = offset;
+
+  if (!sequential)
+    inode->readahead_end = 0;
+  else if (!bypassed)
+    readahead (inode, offset);
 
   return bytes_read;
 }
 
+/* Queues for read-ahead the sectors of INODE in the
+   READAHEAD_SECTORS sectors following byte offset OFFSET that
+   have not been queued already. */
+static void
+readahead (struct inode *inode, off_t offset)
+{
+  off_t start = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+  off_t end = start + READAHEAD_SECTORS * BLOCK_SECTOR_SIZE;
+  off_t pos;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  if (start < inode->readahead_end)
+    start = inode->readahead_end;
+
+  for (pos = start; pos < end; pos += BLOCK_SECTOR_SIZE)
+    cache_readahead (byte_to_sector (inode, pos, NULL));
+  if (end > inode->readahead_end)
+    inode->readahead_end = end;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if an error occurs.
+   A write past end of file extends the inode, filling any gap
+   between the old end of file and OFFSET with zeros.  If disk
+   space runs out, writes as much as fits. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  /* Allocate sectors for any growth.  The new length is set only
+     once the data is written, so that readers never see the
+     sectors before they hold the data. */
+  if (offset + size > inode_length (inode))
+    extend (inode, offset + size);
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in allocated sectors, bytes left in sector,
+         lesser of the two. */
+      off_t inode_left = ((off_t) inode->sector_cnt * BLOCK_SECTOR_SIZE
+                          - offset);
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -280,39 +728,29 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       int chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
+      sector_idx = byte_to_sector (inode, offset, NULL);
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* Copy the chunk into the buffer cache.  A partial sector
+         is read in first; a full one is not. */
+      cache_write_at (sector_idx, buffer + bytes_written,
+                      sector_ofs, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Publish the new length. */
+  lock_acquire (&inode->lock);
+  if (bytes_written > 0 && offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      cache_write_at (inode->sector, &inode->data.length,
+                      offsetof (struct inode_disk, length),
+                      sizeof inode->data.length);
+    }
+  lock_release (&inode->lock);
 
   return bytes_written;
 }
@@ -69,6 +69,55 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns a mask of the bits in element IDX that represent bits
+   START through END, exclusive.  At least one bit of element IDX
+   must lie within the range. */
+static inline elem_type
+range_mask (size_t idx, size_t start, size_t end)
+{
+  size_t lo = idx * ELEM_BITS;
+  elem_type mask = (elem_type) -1;
+
+  if (start > lo)
+    mask &= (elem_type) -1 << (start - lo);
+  if (end < lo + ELEM_BITS)
+    mask &= ((elem_type) 1 << (end - lo)) - 1;
+  return mask;
+}
+
+/* Returns the number of 1-bits in X, which must be 32 bits wide
+   (as elem_type is on the 80x86).  Counts in parallel within
+   the word instead of using __builtin_popcount, which would need
+   libgcc. */
+static inline size_t
+count_ones (elem_type x)
+{
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f;
+  return (x * 0x01010101) >> 24;
+}
+
+/* Returns the index of the first bit in B between START and END,
+   exclusive, that is set to VALUE, or END if there is none.
+   Examines a whole element at a time. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  size_t idx;
+
+  if (start >= end)
+    return end;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+    {
+      elem_type bits = (value ? b->bits[idx] : ~b->bits[idx])
+                       & range_mask (idx, start, end);
+      if (bits != 0)
+        return idx * ELEM_BITS + __builtin_ctzl (bits);
+    }
+  return end;
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -214,18 +263,32 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, but the update as a whole
+   is not atomic. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t end = start + cnt;
+  size_t idx;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  if (cnt == 0)
+    return;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+    {
+      elem_type mask = range_mask (idx, start, end);
+
+      /* Atomic for the same reason as in bitmap_mark() and
+         bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -233,17 +296,19 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t idx, one_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  if (cnt == 0)
+    return 0;
+  one_cnt = 0;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+    one_cnt += count_ones (b->bits[idx] & range_mask (idx, start, end));
+  return value ? one_cnt : cnt - one_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -251,16 +316,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) != start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -292,22 +352,51 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Each candidate group starts at the next bit set to VALUE.  If a
+   bit set to !VALUE cuts it short, the search resumes past that
+   bit, so each bit is examined about once, a whole element at a
+   time. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  return bitmap_scan_range (b, start, b->bit_cnt - start, cnt, value);
+}
+
+/* Finds and returns the starting index of the first group of CNT
+   consecutive bits in B between START and START + SIZE,
+   exclusive, that are all set to VALUE.  Bits outside that range
+   are not examined.
+   If there is no such group, returns BITMAP_ERROR. */
+size_t
+bitmap_scan_range (const struct bitmap *b, size_t start, size_t size,
+                   size_t cnt, bool value) 
+{
+  size_t end = start + size;
+  size_t i = start;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (end <= b->bit_cnt);
+
+  if (cnt == 0)
+    return start;
+  for (;;)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t stop;
+
+      i = find_next (b, i, end, value);
+      if (end - i < cnt)
+        return BITMAP_ERROR;
+      stop = find_next (b, i, i + cnt, !value);
+      if (stop == i + cnt)
+        return i;
+      i = stop;
     }
-  return BITMAP_ERROR;
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -359,6 +448,28 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes to FILE only the part of B that holds the CNT bits
+   starting at START, at the same offset bitmap_write() would use.
+   Returns true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  size_t first, last;
+  off_t ofs, size;
+
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  if (cnt == 0)
+    return true;
+  first = elem_idx (start);
+  last = elem_idx (start + cnt - 1);
+  ofs = first * sizeof (elem_type);
+  size = (last - first + 1) * sizeof (elem_type);
+  return file_write_at (file, b->bits + first, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
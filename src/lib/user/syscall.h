@@ -45,4 +45,7 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Project 3 extension. */
+pid_t fork (void);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,139 @@
+/* Test program and microbenchmark for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan, bitmap_scan_range, bitmap_count, and
+   bitmap_contains against straightforward bit-at-a-time
+   versions, like the ones they replaced, on 1M-bit bitmaps of
+   varying density, and prints how many timer ticks each version
+   takes.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <debug.h>
+#include <bitmap.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Number of bits in the bitmaps we test. */
+#define BIT_CNT (1024 * 1024)
+
+/* Number of queries of each kind per density. */
+#define QUERY_CNT 64
+
+static size_t slow_count (const struct bitmap *, size_t start, size_t cnt,
+                          bool);
+static bool slow_contains (const struct bitmap *, size_t start, size_t cnt,
+                           bool);
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt,
+                         bool);
+
+/* Test the bitmap implementation. */
+void
+test (void)
+{
+  /* Percentage of bits to set in each round. */
+  static const int densities[] = {0, 1, 50, 99, 100};
+  struct bitmap *b = bitmap_create (BIT_CNT);
+  size_t d;
+
+  ASSERT (b != NULL);
+  for (d = 0; d < sizeof densities / sizeof *densities; d++)
+    {
+      int64_t slow_ticks = 0, fast_ticks = 0;
+      size_t i;
+
+      /* Fill B at the given density. */
+      for (i = 0; i < BIT_CNT; i++)
+        bitmap_set (b, i, (int) (random_ulong () % 100) < densities[d]);
+
+      for (i = 0; i < QUERY_CNT; i++)
+        {
+          size_t start = random_ulong () % BIT_CNT;
+          size_t cnt = random_ulong () % (BIT_CNT - start + 1);
+          size_t scan_cnt = 1 + random_ulong () % 16;
+          bool value = random_ulong () % 2;
+          size_t slow[3], fast[3];
+          int64_t t0, t1, t2;
+
+          t0 = timer_ticks ();
+          slow[0] = slow_count (b, start, cnt, value);
+          slow[1] = slow_contains (b, start, cnt, value);
+          slow[2] = slow_scan (b, start, scan_cnt, value);
+          t1 = timer_ticks ();
+          fast[0] = bitmap_count (b, start, cnt, value);
+          fast[1] = bitmap_contains (b, start, cnt, value);
+          fast[2] = bitmap_scan (b, start, scan_cnt, value);
+          t2 = timer_ticks ();
+
+          ASSERT (slow[0] == fast[0]);
+          ASSERT (slow[1] == fast[1]);
+          ASSERT (slow[2] == fast[2]);
+
+          /* A group within the range, if any, is the first group
+             overall, so bitmap_scan_range must find the same one
+             unless it ends past the range. */
+          ASSERT (bitmap_scan_range (b, start, cnt, scan_cnt, value)
+                  == (slow[2] != BITMAP_ERROR
+                      && slow[2] + scan_cnt <= start + cnt
+                      ? slow[2] : BITMAP_ERROR));
+          slow_ticks += t1 - t0;
+          fast_ticks += t2 - t1;
+        }
+
+      printf ("density %3d%%: bit-at-a-time %lld ticks, "
+              "word-at-a-time %lld ticks\n",
+              densities[d], slow_ticks, fast_ticks);
+    }
+  bitmap_destroy (b);
+
+  printf ("bitmap test passed\n");
+}
+
+/* Returns the number of bits in B between START and START + CNT,
+   exclusive, that are set to VALUE, testing one bit at a
+   time. */
+static size_t
+slow_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, value_cnt = 0;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
+
+/* Returns true if any bits in B between START and START + CNT,
+   exclusive, are set to VALUE, testing one bit at a time. */
+static bool
+slow_contains (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      return true;
+  return false;
+}
+
+/* Returns the starting index of the first group of CNT
+   consecutive bits in B at or after START that are all set to
+   VALUE, or BITMAP_ERROR if there is none, by trying each
+   starting index in turn. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  if (cnt <= bitmap_size (b))
+    {
+      size_t last = bitmap_size (b) - cnt;
+      size_t i;
+      for (i = start; i <= last; i++)
+        if (!slow_contains (b, i, cnt, !value))
+          return i;
+    }
+  return BITMAP_ERROR;
+}
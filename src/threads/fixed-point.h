@@ -0,0 +1,52 @@
+#ifndef THREADS_FIXED_POINT_H
+#define THREADS_FIXED_POINT_H
+
+#include <stdint.h>
+
+/* Signed 17.14 fixed-point arithmetic, for the multi-level
+   feedback queue scheduler.
+
+   A fixed-point number X represents the real number X / FP_ONE.
+   The kernel does not use floating point, so this is how it
+   computes the fractional load average and recent CPU values. */
+typedef int fixed_point;
+
+#define FP_FRAC_BITS 14                    /* Bits after the point. */
+#define FP_ONE (1 << FP_FRAC_BITS)         /* 1.0 in fixed point. */
+
+/* Converts integer N to fixed point. */
+static inline fixed_point fp_from_int (int n) {
+  return n * FP_ONE;
+}
+
+/* Converts X to an integer, rounding toward zero. */
+static inline int fp_trunc (fixed_point x) {
+  return x / FP_ONE;
+}
+
+/* Converts X to an integer, rounding to nearest. */
+static inline int fp_round (fixed_point x) {
+  return x >= 0 ? (x + FP_ONE / 2) / FP_ONE : (x - FP_ONE / 2) / FP_ONE;
+}
+
+/* Returns X + N, for integer N. */
+static inline fixed_point fp_add_int (fixed_point x, int n) {
+  return x + n * FP_ONE;
+}
+
+/* Returns X - N, for integer N. */
+static inline fixed_point fp_sub_int (fixed_point x, int n) {
+  return x - n * FP_ONE;
+}
+
+/* Returns X * Y. */
+static inline fixed_point fp_mul (fixed_point x, fixed_point y) {
+  return (int64_t) x * y / FP_ONE;
+}
+
+/* Returns X / Y. */
+static inline fixed_point fp_div (fixed_point x, fixed_point y) {
+  return (int64_t) x * FP_ONE / y;
+}
+
+#endif /* threads/fixed-point.h */
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -32,7 +33,25 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   So that most calls to malloc() and free() need not acquire the
+   descriptor's lock, each descriptor also caches a few free
+   blocks in a "magazine", a small stack that is protected only by
+   disabling interrupts (there is only one CPU).  malloc() takes
+   a block from the magazine if it can, and otherwise takes a
+   batch of blocks from the free list under the lock.  free() puts
+   a block into the magazine if there is room, and otherwise
+   returns a batch of blocks to the free list.  Blocks in a
+   magazine count as in use, as far as their arenas are
+   concerned. */
+
+/* Number of free blocks a descriptor's magazine can hold. */
+#define MAGAZINE_SIZE 16
+
+/* Number of blocks moved between a magazine and its free list
+   at a time. */
+#define MAGAZINE_BATCH (MAGAZINE_SIZE / 2)
 
 /* Descriptor. */
 struct desc
@@ -41,6 +60,8 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+    struct block *magazine[MAGAZINE_SIZE]; /* Cached free blocks. */
+    size_t magazine_cnt;        /* Number of blocks in magazine. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -66,6 +87,10 @@ static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct block *magazine_pop (struct desc *);
+static bool magazine_push (struct desc *, struct block *);
+static struct block *take_block (struct desc *);
+static void release_block (struct desc *, struct block *);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -81,6 +106,7 @@ malloc_init (void)
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
       lock_init (&d->lock);
+      d->magazine_cnt = 0;
     }
 }
 
@@ -92,6 +118,7 @@ malloc (size_t size)
   struct desc *d;
   struct block *b;
   struct arena *a;
+  size_t i;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -119,13 +146,16 @@ malloc (size_t size)
       return a + 1;
     }
 
+  /* Use a cached block if there is one. */
+  b = magazine_pop (d);
+  if (b != NULL)
+    return b;
+
   lock_acquire (&d->lock);
 
   /* If the free list is empty, create a new arena. */
   if (list_empty (&d->free_list))
     {
-      size_t i;
-
       /* Allocate a page. */
       a = palloc_get_page (0);
       if (a == NULL) 
@@ -145,10 +175,18 @@ malloc (size_t size)
         }
     }
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
+  /* Get a block from free list to return, and refill the
+     magazine with a batch of others. */
+  b = take_block (d);
+  for (i = 0; i < MAGAZINE_BATCH && !list_empty (&d->free_list); i++)
+    {
+      struct block *extra = take_block (d);
+      if (!magazine_push (d, extra))
+        {
+          release_block (d, extra);
+          break;
+        }
+    }
   lock_release (&d->lock);
   return b;
 }
@@ -228,30 +266,28 @@ free (void *p)
         {
           /* It's a normal block.  We handle it here. */
 
+          size_t i;
+
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
 
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
+          /* Cache the block if there is room. */
+          if (magazine_push (d, b))
+            return;
 
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          /* Otherwise return it, and a batch of cached blocks, to
+             the free list. */
+          lock_acquire (&d->lock);
+          release_block (d, b);
+          for (i = 0; i < MAGAZINE_BATCH; i++)
             {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
+              b = magazine_pop (d);
+              if (b == NULL)
+                break;
+              release_block (d, b);
             }
-
           lock_release (&d->lock);
         }
       else
@@ -263,6 +299,80 @@ free (void *p)
     }
 }
 
+/* Removes and returns a block from D's magazine, or returns a
+   null pointer if the magazine is empty. */
+static struct block *
+magazine_pop (struct desc *d)
+{
+  struct block *b = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (d->magazine_cnt > 0)
+    b = d->magazine[--d->magazine_cnt];
+  intr_set_level (old_level);
+  return b;
+}
+
+/* Adds block B to D's magazine and returns true, or returns
+   false if the magazine is full. */
+static bool
+magazine_push (struct desc *d, struct block *b)
+{
+  bool success = false;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (d->magazine_cnt < MAGAZINE_SIZE)
+    {
+      d->magazine[d->magazine_cnt++] = b;
+      success = true;
+    }
+  intr_set_level (old_level);
+  return success;
+}
+
+/* Removes and returns a block from D's free list, which must not
+   be empty.  D's lock must be held. */
+static struct block *
+take_block (struct desc *d)
+{
+  struct block *b;
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
+  block_to_arena (b)->free_cnt--;
+  return b;
+}
+
+/* Adds block B to D's free list, freeing its arena if the arena
+   is now entirely unused.  D's lock must be held. */
+static void
+release_block (struct desc *d, struct block *b)
+{
+  struct arena *a = block_to_arena (b);
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      palloc_free_page (a);
+    }
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
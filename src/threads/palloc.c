@@ -9,6 +9,7 @@
 #include <string.h>
 #include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,7 +24,26 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   So that single-page PAL_ZERO requests, such as those made for
+   every new thread, need not zero a page themselves, a
+   low-priority "zeroer" thread keeps a small reserve of
+   already-zeroed pages in each pool.  Pages in a reserve are
+   marked used in the pool's bitmap, but any single-page request
+   may take one when a pool has no other free page, and a
+   multi-page request that finds no free run returns the whole
+   reserve to the pool before giving up.
+
+   The reserve is only best-effort: the zeroer runs at PRI_MIN,
+   or with nice value NICE_MAX under the multi-level feedback
+   queue scheduler, which ignores the priority it was created
+   with.  It therefore refills the reserve mostly while no other
+   thread is ready to run, and requests made while the reserve is
+   empty zero their own pages, as usual. */
+
+/* Number of pre-zeroed pages kept in reserve in each pool. */
+#define ZERO_RESERVE 8
 
 /* A memory pool. */
 struct pool
@@ -31,14 +51,22 @@ struct pool
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    void *zeroed[ZERO_RESERVE];         /* Pre-zeroed pages. */
+    size_t zeroed_cnt;                  /* Number of pre-zeroed pages. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Upped when a pre-zeroed page is taken, to wake the zeroer. */
+static struct semaphore zeroer_wakeup;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static thread_func zeroer NO_RETURN;
+static void refill (struct pool *);
+static void drain (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -59,6 +87,15 @@ palloc_init (size_t user_page_limit)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+  sema_init (&zeroer_wakeup, 0);
+}
+
+/* Starts the thread that keeps each pool's reserve of pre-zeroed
+   pages full.  Must be called after thread_start(). */
+void
+palloc_start_zeroer (void)
+{
+  thread_create ("zeroer", PRI_MIN, zeroer, NULL);
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -72,19 +109,39 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
-  size_t page_idx;
+  size_t page_idx = BITMAP_ERROR;
+  bool took_zeroed = false;
 
   if (page_cnt == 0)
     return NULL;
 
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
+  if (page_cnt != 1 || !(flags & PAL_ZERO) || pool->zeroed_cnt == 0)
+    page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if (page_idx == BITMAP_ERROR && page_cnt > 1 && pool->zeroed_cnt > 0)
+    {
+      /* Reserved pages may be what keeps a run from being
+         free, so give them back and try again. */
+      drain (pool);
+      took_zeroed = true;
+      page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+    }
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
+  else if (page_cnt == 1 && pool->zeroed_cnt > 0)
+    {
+      /* Take a pre-zeroed page, either because zeros were
+         requested or because there is no other free page. */
+      pages = pool->zeroed[--pool->zeroed_cnt];
+      flags &= ~PAL_ZERO;
+      took_zeroed = true;
+    }
   else
     pages = NULL;
+  lock_release (&pool->lock);
+
+  if (took_zeroed)
+    sema_up (&zeroer_wakeup);
 
   if (pages != NULL) 
     {
@@ -148,6 +205,63 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Thread function that refills the pools' reserves of
+   pre-zeroed pages whenever a page is taken from one. */
+static void
+zeroer (void *aux UNUSED)
+{
+  thread_set_nice (NICE_MAX);
+  for (;;)
+    {
+      refill (&kernel_pool);
+      refill (&user_pool);
+      sema_down (&zeroer_wakeup);
+    }
+}
+
+/* Zeroes free pages from POOL and adds them to its reserve until
+   the reserve is full or POOL has no free pages. */
+static void
+refill (struct pool *pool)
+{
+  for (;;)
+    {
+      size_t page_idx = BITMAP_ERROR;
+      void *page;
+
+      lock_acquire (&pool->lock);
+      if (pool->zeroed_cnt < ZERO_RESERVE)
+        page_idx = bitmap_scan_and_flip (pool->used_map, 0, 1, false);
+      lock_release (&pool->lock);
+      if (page_idx == BITMAP_ERROR)
+        return;
+
+      /* Zero the page without holding the lock.  Only this
+         thread adds pages to the reserve, so there is still room
+         afterward. */
+      page = pool->base + PGSIZE * page_idx;
+      memset (page, 0, PGSIZE);
+
+      lock_acquire (&pool->lock);
+      pool->zeroed[pool->zeroed_cnt++] = page;
+      lock_release (&pool->lock);
+    }
+}
+
+/* Returns all the pages in POOL's reserve of pre-zeroed pages to
+   POOL's free pages.  POOL's lock must be held. */
+static void
+drain (struct pool *pool)
+{
+  ASSERT (lock_held_by_current_thread (&pool->lock));
+
+  while (pool->zeroed_cnt > 0)
+    {
+      void *page = pool->zeroed[--pool->zeroed_cnt];
+      bitmap_reset (pool->used_map, pg_no (page) - pg_no (pool->base));
+    }
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
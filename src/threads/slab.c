@@ -0,0 +1,187 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator, after Bonwick's kmem_cache.
+
+   Each cache hands out objects of one exact size, so that, for
+   example, a 580-byte struct inode takes 580 bytes (plus a link)
+   rather than the 1 kB block that malloc() would round it up
+   to.  A cache gets memory from the page allocator one page, or
+   "slab", at a time.  The slab begins with a header and is
+   otherwise divided into equal slots, one per object.  Free
+   objects in a slab are chained through a link stored just past
+   the object in its slot, so that a free object keeps whatever
+   state its constructor gave it.
+
+   Slabs that have free objects are on their cache's list.  A
+   slab whose objects are all free is given back to the page
+   allocator, unless it is the only slab on the list. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    struct list_elem elem;      /* Element in cache's slab list. */
+    struct slab_cache *cache;   /* Owning cache. */
+    void *free;                 /* First free object, or null. */
+    size_t free_cnt;            /* Number of free objects. */
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+  };
+
+/* Offset of the first slot in a slab. */
+#define SLAB_HEADER_SIZE ROUND_UP (sizeof (struct slab), 8)
+
+/* All caches that have been used, for statistics. */
+static struct list all_caches = LIST_INITIALIZER (all_caches);
+
+static void cache_ready (struct slab_cache *);
+static struct slab *new_slab (struct slab_cache *);
+
+/* Returns the location of the free link in object OBJ of cache
+   C. */
+static inline void **
+obj_link (const struct slab_cache *c, void *obj)
+{
+  return (void **) ((uint8_t *) obj + c->link_ofs);
+}
+
+/* Allocates and returns an object from cache C.  Returns a null
+   pointer if memory is not available. */
+void *
+slab_alloc (struct slab_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  if (!c->ready)
+    cache_ready (c);
+
+  lock_acquire (&c->lock);
+  if (list_empty (&c->slabs))
+    {
+      s = new_slab (c);
+      if (s == NULL)
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+      list_push_front (&c->slabs, &s->elem);
+    }
+  s = list_entry (list_front (&c->slabs), struct slab, elem);
+
+  obj = s->free;
+  s->free = *obj_link (c, obj);
+  if (--s->free_cnt == 0)
+    list_remove (&s->elem);
+  c->in_use_cnt++;
+  c->alloc_cnt++;
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns object OBJ, which must have been allocated from cache
+   C, to C.  Does nothing if OBJ is a null pointer. */
+void
+slab_free (struct slab_cache *c, void *obj)
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT (((uint8_t *) obj - (uint8_t *) s - SLAB_HEADER_SIZE)
+          % c->slot_size == 0);
+
+  lock_acquire (&c->lock);
+  *obj_link (c, obj) = s->free;
+  s->free = obj;
+  c->in_use_cnt--;
+  if (s->free_cnt++ == 0)
+    list_push_front (&c->slabs, &s->elem);
+  else if (s->free_cnt == c->slot_cnt
+           && list_front (&c->slabs) != list_back (&c->slabs))
+    {
+      list_remove (&s->elem);
+      s->magic = 0;
+      palloc_free_page (s);
+      c->slab_cnt--;
+    }
+  lock_release (&c->lock);
+}
+
+/* Prints statistics for each cache that has been used. */
+void
+slab_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+      printf ("Slab %s: %zu objects of %zu bytes in %zu slabs, "
+              "%llu allocations\n",
+              c->name, c->in_use_cnt, c->obj_size, c->slab_cnt,
+              c->alloc_cnt);
+    }
+}
+
+/* Initializes the private members of cache C, on first use. */
+static void
+cache_ready (struct slab_cache *c)
+{
+  enum intr_level old_level = intr_disable ();
+  if (!c->ready)
+    {
+      lock_init (&c->lock);
+      list_init (&c->slabs);
+      c->link_ofs = ROUND_UP (c->obj_size, sizeof (void *));
+      c->slot_size = ROUND_UP (c->link_ofs + sizeof (void *), 8);
+      c->slot_cnt = (PGSIZE - SLAB_HEADER_SIZE) / c->slot_size;
+      ASSERT (c->slot_cnt > 0);
+      list_push_back (&all_caches, &c->elem);
+      c->ready = true;
+    }
+  intr_set_level (old_level);
+}
+
+/* Creates and returns a new slab for cache C, with all of its
+   objects free and constructed.  Returns a null pointer if
+   memory is not available.  C's lock must be held. */
+static struct slab *
+new_slab (struct slab_cache *c)
+{
+  struct slab *s;
+  size_t i;
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+  s->cache = c;
+  s->free = NULL;
+  s->free_cnt = c->slot_cnt;
+  s->magic = SLAB_MAGIC;
+
+  /* Chain the objects in address order. */
+  for (i = c->slot_cnt; i-- > 0; )
+    {
+      void *obj = (uint8_t *) s + SLAB_HEADER_SIZE + i * c->slot_size;
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *obj_link (c, obj) = s->free;
+      s->free = obj;
+    }
+  c->slab_cnt++;
+  return s;
+}
@@ -0,0 +1,45 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* A cache of objects of a single type, allocated from slabs of
+   one page each.  Define one with SLAB_CACHE_INITIALIZER, e.g.:
+
+       static struct slab_cache inode_cache
+         = SLAB_CACHE_INITIALIZER ("inode", struct inode, NULL);
+
+   The rest of the members are private to threads/slab.c. */
+struct slab_cache
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Size of an object in bytes. */
+    void (*ctor) (void *);      /* Constructor, or null. */
+
+    bool ready;                 /* Members below initialized? */
+    struct lock lock;           /* Protects the members below. */
+    struct list slabs;          /* Slabs with free objects. */
+    size_t link_ofs;            /* Offset of free link in a slot. */
+    size_t slot_size;           /* Bytes per object slot. */
+    size_t slot_cnt;            /* Object slots per slab. */
+    size_t slab_cnt;            /* Number of slabs. */
+    size_t in_use_cnt;          /* Number of objects allocated. */
+    unsigned long long alloc_cnt; /* Number of allocations ever. */
+    struct list_elem elem;      /* Element in list of all caches. */
+  };
+
+/* Initializer for a cache named NAME of objects of type TYPE.
+   If CTOR is non-null, it is called on each object once, when
+   the slab that holds it is created, and objects must be in
+   their constructed state when they are freed. */
+#define SLAB_CACHE_INITIALIZER(NAME, TYPE, CTOR)                \
+        { .name = (NAME), .obj_size = sizeof (TYPE), .ctor = (CTOR) }
+
+void *slab_alloc (struct slab_cache *);
+void slab_free (struct slab_cache *, void *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
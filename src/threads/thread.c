@@ -1,16 +1,20 @@
 #include "threads/thread.h"
 #include <debug.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -20,9 +24,22 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Number of priority levels. */
+#define PRI_CNT (PRI_MAX - PRI_MIN + 1)
+
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, in one FIFO queue per
+   priority.  Bit P of ready_mask is set if and only if
+   ready_queues[P] is nonempty, so that the highest-priority
+   ready thread can be found in constant time. */
+static struct list ready_queues[PRI_CNT];
+static uint64_t ready_mask;
+static int ready_cnt;           /* Number of threads in ready_queues. */
+
+/* Maximum number of lock holders that a thread's priority is
+   donated through, when the holder of the lock it wants is
+   itself waiting for a lock, and so on. */
+#define DONATE_DEPTH 8
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -37,6 +54,12 @@ static struct thread *initial_thread;
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
+/* Caches for struct child and struct thread_fd. */
+struct slab_cache child_cache
+  = SLAB_CACHE_INITIALIZER ("child", struct child, NULL);
+struct slab_cache thread_fd_cache
+  = SLAB_CACHE_INITIALIZER ("thread_fd", struct thread_fd, NULL);
+
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame 
   {
@@ -59,11 +82,23 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* System load average, for the multi-level feedback queue
+   scheduler: an exponentially weighted moving average of the
+   number of threads ready to run over the last minute. */
+static fixed_point load_avg;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static void set_priority (struct thread *, int priority);
+static void mlfqs_tick (struct thread *);
+static thread_action_func mlfqs_update;
+static int mlfqs_priority (const struct thread *);
+static int ready_max_priority (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
@@ -87,10 +122,14 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i < PRI_CNT; i++)
+    list_init (&ready_queues[i]);
+  ready_mask = 0;
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -134,11 +173,75 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
 }
 
+/* Updates the multi-level feedback queue scheduler's statistics
+   for a timer tick during which T was running, and preempts T if
+   a thread with a higher priority is now ready.  Runs in an
+   external interrupt context.
+
+   Once per second, recomputes the load average and then every
+   thread's recent_cpu and priority.  Every fourth tick in
+   between, only T's recent_cpu has changed, so only T's priority
+   is recomputed. */
+static void
+mlfqs_tick (struct thread *t) 
+{
+  int64_t ticks = timer_ticks ();
+
+  if (t != idle_thread)
+    t->recent_cpu = fp_add_int (t->recent_cpu, 1);
+
+  if (ticks % TIMER_FREQ == 0)
+    {
+      int ready_threads = ready_cnt + (t != idle_thread);
+      fixed_point decay;
+
+      load_avg = (59 * load_avg + fp_from_int (ready_threads)) / 60;
+      decay = fp_div (2 * load_avg, 2 * load_avg + FP_ONE);
+      thread_foreach (mlfqs_update, &decay);
+    }
+  else if (ticks % 4 == 0 && t != idle_thread)
+    set_priority (t, mlfqs_priority (t));
+
+  thread_preempt ();
+}
+
+/* Decays T's recent_cpu by the factor that DECAY_ points to and
+   recomputes T's priority.  Interrupts must be off. */
+static void
+mlfqs_update (struct thread *t, void *decay_) 
+{
+  fixed_point *decay = decay_;
+
+  if (t == idle_thread)
+    return;
+  t->recent_cpu = fp_add_int (fp_mul (*decay, t->recent_cpu), t->nice);
+  set_priority (t, mlfqs_priority (t));
+}
+
+/* Returns the priority that the multi-level feedback queue
+   scheduler assigns to T, given its recent_cpu and nice
+   values. */
+static int
+mlfqs_priority (const struct thread *t) 
+{
+  int priority = PRI_MAX - fp_trunc (t->recent_cpu / 4) - t->nice * 2;
+
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  else if (priority > PRI_MAX)
+    return PRI_MAX;
+  else
+    return priority;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
@@ -159,9 +262,9 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If the new thread's PRIORITY is higher than the running
+   thread's, then the new thread runs before thread_create()
+   returns. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
@@ -185,9 +288,7 @@ thread_create (const char *name, int priority,
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
 
-  _c = malloc(sizeof(struct child));
-  t->pData = (struct process_data*)aux;
-  t->pData->t = t;
+  _c = slab_alloc(&child_cache);
 
   _c->child = t;
   _c->tid = t->tid;
@@ -244,10 +345,12 @@ thread_block (void)
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
-   This function does not preempt the running thread.  This can
-   be important: if the caller had disabled interrupts itself,
-   it may expect that it can atomically unblock a thread and
-   update other data. */
+   If T has a higher priority than the running thread, then the
+   running thread is preempted, as described for
+   thread_preempt().  In particular, it is not preempted if the
+   caller had disabled interrupts itself, because it may expect
+   that it can atomically unblock a thread and update other
+   data. */
 void
 thread_unblock (struct thread *t) 
 {
@@ -257,9 +360,97 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  ready_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
+
+  thread_preempt ();
+}
+
+/* Yields the CPU if a thread with a higher priority than the
+   running thread is ready to run.  In an interrupt handler, the
+   yield happens as the interrupt returns.  Otherwise, nothing
+   happens if interrupts are disabled, so that callers can
+   make several changes atomically and call this function after
+   turning interrupts back on. */
+void
+thread_preempt (void) 
+{
+  enum intr_level old_level;
+  bool preempt;
+
+  if (!intr_context () && intr_get_level () == INTR_OFF)
+    return;
+
+  old_level = intr_disable ();
+  preempt = ready_max_priority () > running_thread ()->priority;
+  intr_set_level (old_level);
+
+  if (!preempt)
+    return;
+  if (intr_context ())
+    intr_yield_on_return ();
+  else
+    thread_yield ();
+}
+
+/* Donates DONOR's priority to the holder of the lock that DONOR
+   is waiting for, if that is higher than the holder's priority,
+   and so on along the chain of holders that are themselves
+   waiting for locks, up to DONATE_DEPTH holders.  Interrupts
+   must be off. */
+void
+thread_donate_priority (struct thread *donor) 
+{
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_mlfqs)
+    return;
+  for (depth = 0; depth < DONATE_DEPTH && donor->waiting_lock != NULL;
+       depth++)
+    {
+      struct thread *holder = donor->waiting_lock->holder;
+      if (holder == NULL || holder->priority >= donor->priority)
+        break;
+      set_priority (holder, donor->priority);
+      donor = holder;
+    }
+}
+
+/* Recomputes T's priority as the highest of its base priority
+   and the priorities of the threads waiting for locks that T
+   holds.  Interrupts must be off.
+
+   Does nothing if the multi-level feedback queue scheduler is in
+   use, because it does not donate priority. */
+void
+thread_update_priority (struct thread *t) 
+{
+  int priority = t->base_priority;
+  struct list_elem *l, *w;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_mlfqs)
+    return;
+
+  for (l = list_begin (&t->locks); l != list_end (&t->locks);
+       l = list_next (l))
+    {
+      struct lock *lock = list_entry (l, struct lock, elem);
+      struct list *waiters = &lock->semaphore.waiters;
+
+      for (w = list_begin (waiters); w != list_end (waiters);
+           w = list_next (w))
+        {
+          struct thread *waiter = list_entry (w, struct thread, elem);
+          if (waiter->priority > priority)
+            priority = waiter->priority;
+        }
+    }
+  set_priority (t, priority);
 }
 
 /* Returns the name of the running thread. */
@@ -300,6 +491,8 @@ thread_tid (void)
 void
 thread_exit (void) 
 {
+  struct thread *cur;
+
   ASSERT (!intr_context ());
 
 #ifdef USERPROG
@@ -310,8 +503,19 @@ thread_exit (void)
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
-  list_remove (&thread_current()->allelem);
-  thread_current ()->status = THREAD_DYING;
+  cur = thread_current ();
+  list_remove (&cur->allelem);
+
+  /* Disown any locks we still hold, so that threads waiting for
+     them do not donate priority to us after we are destroyed.
+     The locks stay unavailable, as before. */
+  while (!list_empty (&cur->locks))
+    {
+      struct list_elem *e = list_pop_front (&cur->locks);
+      list_entry (e, struct lock, elem)->holder = NULL;
+    }
+
+  cur->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
 }
@@ -328,7 +532,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    list_push_back (&ready_list, &cur->elem);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -351,11 +555,29 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY,
+   yielding if it no longer has the highest priority.  The
+   thread keeps any higher priority donated to it until it
+   releases the locks concerned.  The multi-level feedback queue
+   scheduler sets priorities itself, so this function does
+   nothing if it is in use. */
 void
 thread_set_priority (int new_priority) 
 {
-  thread_current ()->priority = new_priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_update_priority (cur);
+  intr_set_level (old_level);
+
+  thread_preempt ();
 }
 
 /* Returns the current thread's priority. */
@@ -365,46 +587,64 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it no longer has the highest
+   priority. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    set_priority (cur, mlfqs_priority (cur));
+  intr_set_level (old_level);
+
+  thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load_avg_100 = fp_round (load_avg * 100);
+  intr_set_level (old_level);
+
+  return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent_cpu_100 = fp_round (thread_current ()->recent_cpu * 100);
+  intr_set_level (old_level);
+
+  return recent_cpu_100;
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
 
-   The idle thread is initially put on the ready list by
+   The idle thread is initially put on the ready queues by
    thread_start().  It will be scheduled once initially, at which
    point it initializes idle_thread, "up"s the semaphore passed
    to it to enable thread_start() to continue, and immediately
    blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   ready queues.  It is returned by next_thread_to_run() as a
+   special case when the ready queues are empty. */
 static void
 idle (void *idle_started_ UNUSED) 
 {
@@ -418,6 +658,10 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Stop the periodic timer interrupt, if enabled, until
+         something needs doing. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -479,10 +723,22 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  if (t != initial_thread)
+    {
+      /* Inherit the creating thread's scheduling statistics. */
+      t->nice = running_thread ()->nice;
+      t->recent_cpu = running_thread ()->recent_cpu;
+    }
+  if (thread_mlfqs)
+    priority = mlfqs_priority (t);
+  t->priority = t->base_priority = priority;
+  list_init (&t->locks);
   t->magic = THREAD_MAGIC;
   list_push_back (&all_list, &t->allelem);
   list_init (&t->child_list);
+#ifdef VM
+  list_init (&t->mappings);
+#endif
 
 }
 
@@ -503,14 +759,85 @@ alloc_frame (struct thread *t, size_t size)
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   idle_thread.
+
+   The thread returned is the one that has waited longest among
+   those with the highest priority. */
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  int priority = ready_max_priority ();
+  struct list *queue;
+  struct thread *t;
+
+  if (priority < PRI_MIN)
     return idle_thread;
+
+  queue = &ready_queues[priority - PRI_MIN];
+  t = list_entry (list_front (queue), struct thread, elem);
+  ready_remove (t);
+  return t;
+}
+
+/* Adds T to the back of the ready queue for its priority.
+   Interrupts must be off. */
+static void
+ready_push (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_push_back (&ready_queues[t->priority - PRI_MIN], &t->elem);
+  ready_mask |= (uint64_t) 1 << (t->priority - PRI_MIN);
+  ready_cnt++;
+}
+
+/* Removes T from its ready queue.  Interrupts must be off. */
+static void
+ready_remove (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority - PRI_MIN]))
+    ready_mask &= ~((uint64_t) 1 << (t->priority - PRI_MIN));
+  ready_cnt--;
+}
+
+/* Sets T's priority to PRIORITY, moving T to the matching ready
+   queue if it is ready.  Interrupts must be off. */
+static void
+set_priority (struct thread *t, int priority) 
+{
+  if (t->status == THREAD_READY)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    t->priority = priority;
+}
+
+/* Returns the highest priority of any ready thread, or
+   PRI_MIN - 1 if no thread is ready.  Interrupts must be off.
+
+   Finds the most significant bit set in ready_mask one 32-bit
+   half at a time, so that GCC emits a BSR instruction instead of
+   a call into libgcc. */
+static int
+ready_max_priority (void) 
+{
+  uint32_t hi = ready_mask >> 32;
+  uint32_t lo = ready_mask;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (hi != 0)
+    return PRI_MIN + 63 - __builtin_clz (hi);
+  else if (lo != 0)
+    return PRI_MIN + 31 - __builtin_clz (lo);
+  else
+    return PRI_MIN - 1;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -542,6 +869,11 @@ thread_schedule_tail (struct thread *prev)
   /* Start new time slice. */
   thread_ticks = 0;
 
+  /* Restart the periodic timer interrupt if we just switched
+     away from the idle thread. */
+  if (prev != NULL && prev == idle_thread)
+    timer_idle_exit ();
+
 #ifdef USERPROG
   /* Activate the new address space. */
   process_activate ();
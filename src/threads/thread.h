@@ -2,8 +2,10 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/fixed-point.h"
 #include "threads/synch.h"
 
 /* States in a thread's life cycle. */
@@ -30,6 +32,12 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread nice values, for the multi-level feedback queue
+   scheduler. */
+#define NICE_MIN -20                    /* Least nice. */
+#define NICE_DEFAULT 0                  /* Default nice value. */
+#define NICE_MAX 20                     /* Nicest. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -93,18 +101,28 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Priority, including donations. */
+    int base_priority;                  /* Priority before donations. */
+    int nice;                           /* Nice value, for MLFQS. */
+    fixed_point recent_cpu;             /* Recent CPU time, for MLFQS. */
     struct list_elem allelem;           /* List element for all threads list. */
 
+    /* Shared between thread.c and synch.c. */
+    struct list locks;                  /* Locks held. */
+    struct lock *waiting_lock;          /* Lock being acquired, or NULL. */
+
     struct thread *parent;
     struct list_elem child_elem;
     struct list child_list;
     struct child *self_info;
     struct process_data *pData;
     //bool load_success;
-    /* Shared between thread.c and synch.c. */
+    /* Shared between thread.c, synch.c, and devices/timer.c. */
     struct list_elem elem;              /* List element. */
 
+    /* Owned by devices/timer.c. */
+    int64_t wake_tick;                  /* Tick to wake up at, if asleep. */
+
     struct thread_fd* thread_fd[128];
     
 #ifdef USERPROG
@@ -112,6 +130,18 @@ struct thread
     uint32_t *pagedir;                  /* Page directory. */
 #endif
 
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash *pages;                 /* Supplemental page table. */
+    struct file *exec_file;             /* Executable, for loading pages. */
+    void *user_esp;                     /* User stack pointer on entry
+                                           to a system call. */
+
+    /* Owned by vm/mmap.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Next map region identifier. */
+#endif
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
@@ -125,6 +155,10 @@ struct child
   // bool load_success;
   int status;
 };
+
+/* Caches for struct child and struct thread_fd. */
+extern struct slab_cache child_cache;
+extern struct slab_cache thread_fd_cache;
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
@@ -141,6 +175,9 @@ tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
+void thread_preempt (void);
+void thread_donate_priority (struct thread *);
+void thread_update_priority (struct thread *);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
@@ -4,6 +4,10 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -149,6 +153,24 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* Bring in a page that has not been loaded yet, or grow the
+     stack.  This also covers the kernel touching user memory on
+     a process's behalf in system calls, when f->esp is the
+     kernel's stack pointer and the user's was saved on entry. */
+  if (not_present && is_user_vaddr (fault_addr)
+      && (page_in (fault_addr, write)
+          || page_grow_stack (fault_addr,
+                              user ? f->esp : thread_current ()->user_esp)))
+    return;
+
+  /* Give the process its own copy of a copy-on-write page that
+     it writes. */
+  if (!not_present && write && is_user_vaddr (fault_addr)
+      && page_unshare (fault_addr))
+    return;
+#endif
+
   sys_exit(-1);
 
   /* To implement virtual memory, delete the rest of the function
@@ -16,11 +16,20 @@
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+static bool fork_files (struct thread *parent);
+#endif
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
@@ -68,7 +77,7 @@ process_execute (const char *file_name)
     cData = pd->t->self_info;
     e = &cData->child_elem;
     list_remove(e);
-    free(cData);
+    slab_free(&child_cache, cData);
     return TID_ERROR;
   }
 
@@ -102,6 +111,9 @@ start_process (void *pd_)
   struct intr_frame if_;
   bool success;
 
+  t->pData = pd;
+  pd->t = t;
+
   file_name = strtok_r(file_name, " ", &remain);
 
   if(file_name != NULL){
@@ -194,6 +206,138 @@ start_process (void *pd_)
   NOT_REACHED ();
 }
 
+#ifdef VM
+/* Data passed from process_fork() to start_fork(). */
+struct fork_data
+  {
+    struct thread *parent;      /* Forking thread. */
+    struct intr_frame if_;      /* Parent's user context. */
+    struct semaphore done;      /* Upped when the child is set up. */
+    bool success;               /* Was the child set up? */
+  };
+
+/* Starts a new process that is a copy of the current one,
+   resuming from the system call whose interrupt frame is F with
+   a return value of 0.  Pages that the current process has
+   loaded are shared copy-on-write, so the copy takes time in
+   proportion to the pages that are later modified rather than
+   to the size of the process.  Memory-mapped files are not
+   inherited.  Returns the new process's thread id, or TID_ERROR
+   if it cannot be created. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct thread *cur = thread_current ();
+  struct fork_data fd;
+  tid_t tid;
+
+  fd.parent = cur;
+  fd.if_ = *f;
+  sema_init (&fd.done, 0);
+  fd.success = false;
+
+  tid = thread_create (cur->name, PRI_DEFAULT, start_fork, &fd);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+  sema_down (&fd.done);
+  if (!fd.success)
+    {
+      /* Reap the child, which has exited. */
+      process_wait (tid);
+      return TID_ERROR;
+    }
+  return tid;
+}
+
+/* A thread function that sets up a copy of the process that
+   called process_fork() and starts it running. */
+static void
+start_fork (void *fd_)
+{
+  struct fork_data *fd = fd_;
+  struct thread *parent = fd->parent;
+  struct thread *t = thread_current ();
+  struct intr_frame if_;
+  bool success = false;
+
+  /* FD is on the parent's stack, so copy out what we need before
+     letting the parent continue. */
+  if_ = fd->if_;
+
+  lock_acquire (&t->self_info->lock_wait);
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    goto done;
+  process_activate ();
+
+  t->exec_file = file_reopen (parent->exec_file);
+  if (t->exec_file == NULL)
+    goto done;
+  file_deny_write (t->exec_file);
+
+  success = (page_table_create ()
+             && page_table_fork (parent, t->exec_file)
+             && fork_files (parent));
+
+ done:
+  fd->success = success;
+  sema_up (&fd->done);
+  if (!success)
+    {
+      /* The child never ran, so end it quietly instead of through
+         sys_exit(), which would print an exit message for it.
+         process_exit() frees its memory and executable. */
+      int i;
+
+      for (i = 2; i < 128; i++)
+        if (t->thread_fd[i] != NULL)
+          {
+            file_close (t->thread_fd[i]->file);
+            slab_free (&thread_fd_cache, t->thread_fd[i]);
+            t->thread_fd[i] = NULL;
+          }
+      t->self_info->status = -1;
+      lock_release (&t->self_info->lock_wait);
+      thread_exit ();
+    }
+
+  /* Return 0 from the system call in the child. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives the current thread its own copy of each of PARENT's open
+   files, at the same position.  Returns true if successful,
+   false if memory allocation fails. */
+static bool
+fork_files (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  int i;
+
+  for (i = 2; i < 128; i++)
+    if (parent->thread_fd[i] != NULL)
+      {
+        struct file *file = parent->thread_fd[i]->file;
+        struct thread_fd *fd = slab_alloc (&thread_fd_cache);
+
+        if (fd == NULL)
+          return false;
+        fd->fd = i;
+        fd->file = file_reopen (file);
+        if (fd->file == NULL)
+          {
+            slab_free (&thread_fd_cache, fd);
+            return false;
+          }
+        file_seek (fd->file, file_tell (file));
+        t->thread_fd[i] = fd;
+      }
+  return true;
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -216,8 +360,9 @@ process_wait (tid_t child_tid UNUSED)
     if(cData->tid == child_tid ){
       lock_acquire(&cData->lock_wait);
       status = cData->status;
+      lock_release(&cData->lock_wait);
       list_remove(e);
-      free(cData);
+      slab_free(&child_cache, cData);
       break;
     }
   }
@@ -232,6 +377,16 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+#ifdef VM
+  /* Write back and unmap memory-mapped files, forget where the
+     process's other pages come from, and close the executable
+     that some of them are loaded from. */
+  mmap_unmap_all ();
+  page_table_destroy ();
+  file_close (cur->exec_file);
+  cur->exec_file = NULL;
+#endif
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -354,6 +509,10 @@ load (const char *file_name, void (**eip) (void), void **esp)
   if (t->pagedir == NULL) 
     goto done;
   process_activate ();
+#ifdef VM
+  if (!page_table_create ())
+    goto done;
+#endif
 
   /* Open executable file. */
   file = filesys_open (file_name);
@@ -362,6 +521,12 @@ load (const char *file_name, void (**eip) (void), void **esp)
       printf ("load: %s: open failed\n", file_name);
       goto done; 
     }
+#ifdef VM
+  /* Pages are loaded from the executable on demand, so keep it
+     open, and unmodified, until the process exits. */
+  t->exec_file = file;
+  file_deny_write (file);
+#endif
 
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -446,13 +611,17 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
  done:
   /* We arrive here whether the load is successful or not. */
+#ifndef VM
   file_close (file);
+#endif
   return success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -511,6 +680,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only recorded in the
+   supplemental page table here, and each one is read in when it
+   is first accessed.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -521,7 +694,9 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifndef VM
   file_seek (file, ofs);
+#endif
   while (read_bytes > 0 || zero_bytes > 0) 
     {
       /* Calculate how to fill this page.
@@ -530,6 +705,12 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      /* Record where to load this page from. */
+      if (!page_add_file (upage, file, ofs, page_read_bytes, writable))
+        return false;
+      ofs += page_read_bytes;
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -549,6 +730,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -560,6 +742,20 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 
 /* Create a minimal stack by mapping a zeroed page at the top of
    user virtual memory. */
+#ifdef VM
+static bool
+setup_stack (void **esp) 
+{
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+
+  /* The arguments are pushed right away, so bring the page in
+     now rather than waiting for a fault. */
+  if (!page_add_zero (upage, true) || !page_in (upage, true))
+    return false;
+  *esp = PHYS_BASE;
+  return true;
+}
+#else
 static bool
 setup_stack (void **esp) 
 {
@@ -577,7 +773,9 @@ setup_stack (void **esp)
     }
   return success;
 }
+#endif
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -597,3 +795,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
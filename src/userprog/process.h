@@ -2,9 +2,13 @@
 #define USERPROG_PROCESS_H
 
 #include "threads/thread.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
 
 tid_t process_execute (const char *file_name);
+#ifdef VM
+tid_t process_fork (const struct intr_frame *);
+#endif
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
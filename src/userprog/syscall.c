@@ -5,10 +5,16 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
 #include "devices/shutdown.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "filesys/off_t.h"
 #include <string.h>
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 typedef int pid_t;
 
@@ -33,6 +39,11 @@ unsigned sys_tell(int fd);
 void sys_close(int fd);
 int sys_read(int fd, void *buffer, unsigned size);
 int sys_write(int fd, const void *buffer, unsigned size);
+#ifdef VM
+mapid_t sys_mmap(int fd, void *addr);
+void sys_munmap(mapid_t mapid);
+pid_t sys_fork(struct intr_frame *f);
+#endif
 
 void
 syscall_init (void) 
@@ -48,7 +59,14 @@ syscall_handler (struct intr_frame *f UNUSED)
   int ret_val;
   syscall_num = *(int *)esp_val(esp, 0);
 
+#ifdef VM
+  /* Save the user stack pointer, for growing the stack if a page
+     fault occurs in the kernel. */
+  thread_current()->user_esp = esp;
+  if(page_lookup(esp) == NULL) sys_exit(-1);
+#else
   if(!pagedir_get_page(thread_current()->pagedir, esp)) sys_exit(-1);
+#endif
 
 
   switch( syscall_num) {
@@ -128,6 +146,24 @@ syscall_handler (struct intr_frame *f UNUSED)
       sys_close( * (int *) esp_val(esp, 1));
       break;
 
+#ifdef VM
+    case SYS_MMAP:
+      if(!check_user_mem(esp, 2)) 
+        sys_exit(-1);
+      ret_val = sys_mmap(* (int*) esp_val(esp, 1),* (void **) esp_val(esp, 2));
+      break;
+
+    case SYS_MUNMAP:
+      if(!check_user_mem(esp, 1)) 
+        sys_exit(-1);
+      sys_munmap(* (mapid_t*) esp_val(esp, 1));
+      break;
+
+    case SYS_FORK:
+      ret_val = sys_fork(f);
+      break;
+#endif
+
     default:
       sys_exit(-1);
       break;
@@ -166,11 +202,11 @@ void sys_exit (int status){
        sys_wait(cData->tid);
    
        e = list_next(e);
-       free(cData);
+       slab_free(&child_cache, cData);
   } 
   for(i=2;i<128;i++)
   {
-    free(t->thread_fd[i]);
+    slab_free(&thread_fd_cache, t->thread_fd[i]);
   }
 
   printf("%s: exit(%d)\n", thread_current()->name, status);
@@ -212,14 +248,14 @@ int sys_open(const char* file){
     if(file == NULL)
         sys_exit(-1);
     
-    fd = calloc(1, sizeof(struct thread_fd)); 
+    fd = slab_alloc(&thread_fd_cache);
 
 
     fd->file = filesys_open (file);//open
 
     if(fd->file == NULL)
     {
-        free(fd);
+        slab_free(&thread_fd_cache, fd);
         return -1;
     }
     for(i=2;i<128;i++)
@@ -270,7 +306,7 @@ void sys_close(int fd){
 
    file_allow_write(cur->thread_fd[fd]->file);
    file_close(cur->thread_fd[fd]->file);
-   free(cur->thread_fd[fd]);
+   slab_free(&thread_fd_cache, cur->thread_fd[fd]);
    cur->thread_fd[fd] = NULL;
 };
 int sys_read(int fd, void *buffer, unsigned size){
@@ -281,21 +317,28 @@ int sys_read(int fd, void *buffer, unsigned size){
 
   if(fd<0 || fd>128)
       sys_exit(-1);
+
+#ifdef VM
+  /* Load and pin the buffer, so that reading into it cannot
+     fault while file system locks are held. */
+  if (!page_pin_range (buffer, size, true))
+    sys_exit (-1);
+#endif
   
   if(fd == 0){
     for(read_size=0; read_size < size; read_size++)
       {
-          *((char*)buffer++) = input_getc ();
+          ((char*)buffer)[read_size] = input_getc ();
       }
-    return read_size;
-  
   }
-      
-  if(thread_current()->thread_fd[fd] == NULL)
-      return -1;
-
-      
-  read_size = file_read(thread_current()->thread_fd[fd]->file, buffer, size);
+  else if(thread_current()->thread_fd[fd] == NULL)
+      read_size = -1;
+  else
+      read_size = file_read(thread_current()->thread_fd[fd]->file, buffer, size);
+
+#ifdef VM
+  page_unpin_range (buffer, size);
+#endif
   return read_size;
 };
 
@@ -308,16 +351,42 @@ int sys_write(int fd, const void *buffer, unsigned size){
   if(fd<0 || fd>128)
     sys_exit(-1);
 
+#ifdef VM
+  /* Load and pin the buffer, so that reading from it cannot
+     fault while file system or console locks are held. */
+  if (!page_pin_range (buffer, size, false))
+    sys_exit (-1);
+#endif
+
   if (fd == 1){
     putbuf(buffer, size);
-    return size;
+    write_size = size;
   }
+  else if(thread_current()->thread_fd[fd] == NULL)
+    write_size = -1;
+  else
+    write_size = file_write(thread_current()->thread_fd[fd]->file, buffer, size);
+
+#ifdef VM
+  page_unpin_range (buffer, size);
+#endif
+  return write_size;
+};
 
+#ifdef VM
+mapid_t sys_mmap(int fd, void *addr){
 
-  if(thread_current()->thread_fd[fd] == NULL)
-    return -1;
+  if(fd<2 || fd>=128 || thread_current()->thread_fd[fd] == NULL)
+    return MAP_FAILED;
 
-  write_size = file_write(thread_current()->thread_fd[fd]->file, buffer, size);
-   
-  return write_size;
+  return mmap_map(thread_current()->thread_fd[fd]->file, addr);
+};
+
+void sys_munmap(mapid_t mapid){
+  mmap_unmap(mapid);
+};
+
+pid_t sys_fork(struct intr_frame *f){
+  return process_fork(f);
 };
+#endif
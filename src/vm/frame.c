@@ -0,0 +1,134 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* Every frame that holds a user page is in the frame table.  When
+   the user pool is exhausted, a frame is taken away from its
+   page, choosing the victim with the "second chance" clock
+   algorithm over the frames' accessed bits.
+
+   A single lock, frame_lock, protects the frame table and the
+   residency state of every page (its frame, swap slot, and page
+   table entry), so that a page is never faulted in while it is
+   being evicted. */
+static struct list frames;          /* All frames, in clock order. */
+static struct list_elem *clock_hand;  /* Next frame the clock examines. */
+static struct lock frame_lock;      /* Protects frames and page residency. */
+
+static struct frame *evict (void);
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  list_init (&frames);
+  clock_hand = list_end (&frames);
+  lock_init (&frame_lock);
+}
+
+/* Acquires the frame lock. */
+void
+frame_acquire (void)
+{
+  lock_acquire (&frame_lock);
+}
+
+/* Releases the frame lock. */
+void
+frame_release (void)
+{
+  lock_release (&frame_lock);
+}
+
+/* Obtains a frame for page P, evicting another page if no user
+   frame is free, and returns it pinned.  Returns a null pointer
+   if no frame can be obtained.  The frame lock must be held. */
+struct frame *
+frame_alloc (struct page *p)
+{
+  struct frame *f;
+  void *kpage;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  kpage = palloc_get_page (PAL_USER);
+  if (kpage != NULL)
+    {
+      f = malloc (sizeof *f);
+      if (f == NULL)
+        {
+          palloc_free_page (kpage);
+          return NULL;
+        }
+      f->kpage = kpage;
+      list_push_back (&frames, &f->elem);
+    }
+  else
+    {
+      f = evict ();
+      if (f == NULL)
+        return NULL;
+    }
+  f->page = p;
+  f->pin_cnt = 1;
+  return f;
+}
+
+/* Frees frame F, which must no longer be mapped by its page.
+   The frame lock must be held. */
+void
+frame_free (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (clock_hand == &f->elem)
+    clock_hand = list_next (clock_hand);
+  list_remove (&f->elem);
+  palloc_free_page (f->kpage);
+  free (f);
+}
+
+/* Advances the clock hand and returns the frame it passed over. */
+static struct frame *
+clock_next (void)
+{
+  struct frame *f;
+
+  if (clock_hand == list_end (&frames))
+    clock_hand = list_begin (&frames);
+  f = list_entry (clock_hand, struct frame, elem);
+  clock_hand = list_next (clock_hand);
+  return f;
+}
+
+/* Chooses a victim frame with the clock algorithm, pages its
+   contents out, and returns it, now owned by no page.  A victim
+   that cannot be paged out, because swap is full, stays put and
+   the sweep goes on, since a clean page may still be evictable.
+   Returns a null pointer if no frame could be evicted. */
+static struct frame *
+evict (void)
+{
+  size_t i, n = list_size (&frames);
+
+  /* Two sweeps suffice: the first clears every accessed bit that
+     is set. */
+  for (i = 0; i < 2 * n; i++)
+    {
+      struct frame *f = clock_next ();
+
+      if (f->pin_cnt > 0)
+        continue;
+      if (page_accessed_recently (f->page))
+        continue;
+      if (!page_out (f->page))
+        continue;
+      f->page = NULL;
+      return f;
+    }
+  return NULL;
+}
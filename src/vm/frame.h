@@ -0,0 +1,25 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdbool.h>
+
+struct page;
+
+/* A frame of physical memory from the user pool that holds a
+   user page. */
+struct frame
+  {
+    struct list_elem elem;      /* Element in frame list. */
+    void *kpage;                /* Kernel virtual address. */
+    struct page *page;          /* Page held in the frame. */
+    unsigned pin_cnt;           /* Frame may not be evicted while nonzero. */
+  };
+
+void frame_init (void);
+void frame_acquire (void);
+void frame_release (void);
+struct frame *frame_alloc (struct page *);
+void frame_free (struct frame *);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,123 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* A memory-mapped file.  Its pages are ordinary pages in the
+   process's supplemental page table, loaded from the file on
+   demand and written back to it when modified (see
+   page_add_mmap()). */
+struct mapping
+  {
+    struct list_elem elem;      /* Element in thread's mappings. */
+    mapid_t mapid;              /* Map region identifier. */
+    struct file *file;          /* File, reopened for the mapping. */
+    uint8_t *base;              /* Start of mapping in user memory. */
+    size_t page_cnt;            /* Number of pages mapped. */
+  };
+
+static void unmap (struct mapping *);
+
+/* Maps FILE into the current process's address space starting at
+   ADDR, which must be page-aligned and nonzero.  Returns the new
+   mapping's identifier, or MAP_FAILED if FILE is empty, if any
+   page in the range is already in use, outside user memory, or
+   within page_stack_max of PHYS_BASE, where the stack may grow,
+   or if memory allocation fails. */
+mapid_t
+mmap_map (struct file *file, void *addr)
+{
+  struct thread *t = thread_current ();
+  uint8_t *stack_bottom = (uint8_t *) PHYS_BASE - page_stack_max;
+  struct mapping *m;
+  off_t length;
+  size_t page_cnt, i;
+
+  if (file == NULL || addr == NULL || pg_ofs (addr) != 0
+      || !is_user_vaddr (addr) || (uint8_t *) addr >= stack_bottom)
+    return MAP_FAILED;
+  length = file_length (file);
+  if (length <= 0)
+    return MAP_FAILED;
+  page_cnt = DIV_ROUND_UP (length, PGSIZE);
+  if (page_cnt > (size_t) (stack_bottom - (uint8_t *) addr) / PGSIZE)
+    return MAP_FAILED;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return MAP_FAILED;
+    }
+  m->base = addr;
+  m->page_cnt = 0;
+  for (i = 0; i < page_cnt; i++)
+    {
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+      if (!page_add_mmap (m->base + ofs, m->file, ofs, read_bytes))
+        {
+          unmap (m);
+          return MAP_FAILED;
+        }
+      m->page_cnt++;
+    }
+
+  m->mapid = t->next_mapid++;
+  list_push_back (&t->mappings, &m->elem);
+  return m->mapid;
+}
+
+/* Unmaps the current process's mapping MAPID, if it exists,
+   writing modified pages back to the file. */
+void
+mmap_unmap (mapid_t mapid)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&t->mappings); e != list_end (&t->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->mapid == mapid)
+        {
+          list_remove (&m->elem);
+          unmap (m);
+          return;
+        }
+    }
+}
+
+/* Unmaps all of the current process's mappings, writing modified
+   pages back to their files.  Called when the process exits. */
+void
+mmap_unmap_all (void)
+{
+  struct thread *t = thread_current ();
+
+  while (!list_empty (&t->mappings))
+    unmap (list_entry (list_pop_front (&t->mappings),
+                       struct mapping, elem));
+}
+
+/* Removes M's pages, closes its file, and frees M. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (m->base + i * PGSIZE);
+  file_close (m->file);
+  free (m);
+}
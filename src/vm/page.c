@@ -0,0 +1,864 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Pages are not loaded when a process starts.  Instead, load()
+   records where each page's contents come from in the process's
+   supplemental page table, and the page fault handler calls
+   page_in() to bring a page in the first time it is touched.
+
+   When memory runs short, the frame table takes frames away from
+   pages with page_out(), which saves modified pages to swap and
+   simply drops unmodified ones, to be reloaded from their file
+   or zeroed again.
+
+   Read-only pages loaded from a file, such as the code pages of
+   an executable, never differ from the file, so every process
+   that maps the same file offset shares a single frame for them.
+   Each such page is on the list of a shared_page for its inode,
+   offset, and number of bytes read, which holds the frame while
+   any page is mapped and is freed along with the last page on
+   its list.  (Pages that read different numbers of bytes from
+   the same offset differ in their zero-filled tails, so they
+   cannot share.)
+
+   fork() shares a process's other pages that have been loaded
+   with its child in the same way, copy-on-write.  The shared
+   frame is mapped read-only in both processes, and the first
+   write to the page in either one gives that process a private
+   copy.  Such a shared_page has no inode and is not in
+   shared_pages, and its contents go to swap when it is
+   evicted.
+
+   Finally, an all-zero page that has not been written is mapped
+   read-only to a single frame of zeros, zero_frame, so that
+   large, untouched BSS arrays and stack regions take no memory.
+   The first write to the page gives it a frame of its own. */
+
+/* A page shared by several processes, either a read-only file
+   page or a copy-on-write page. */
+struct shared_page
+  {
+    struct hash_elem hash_elem; /* Element in shared_pages. */
+    struct inode *inode;        /* File's inode, or null if
+                                   copy-on-write. */
+    off_t ofs;                  /* Offset in file. */
+    size_t read_bytes;          /* Bytes read from file. */
+    struct frame *frame;        /* Frame holding the page, or null. */
+    size_t swap_slot;           /* Swap slot holding a copy-on-write
+                                   page, or SWAP_ERROR. */
+    struct list pages;          /* Pages that share it. */
+  };
+
+/* All shared pages, protected by the frame lock. */
+static struct hash shared_pages;
+
+/* Frame of zeros shared by all untouched all-zero pages.  It is
+   not in the frame table, so it is never evicted. */
+static struct frame zero_frame;
+
+/* Maximum size of a user stack, in bytes.  Stack pages below the
+   first are added on demand, when the process touches them. */
+size_t page_stack_max = 8 * 1024 * 1024;
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+static bool add_page (void *upage, struct file *, off_t, size_t read_bytes,
+                      bool writable, bool write_back);
+static struct page *new_page (void *upage, struct file *, off_t,
+                              size_t read_bytes, bool writable,
+                              bool write_back);
+static hash_hash_func shared_hash;
+static hash_less_func shared_less;
+static bool share_page (struct page *);
+static bool fork_page (struct page *, struct file *exec_file);
+static bool unshare_page (struct page *);
+static bool needs_unshare (const struct page *);
+static struct page *add_stack_page (const void *addr, const void *esp);
+
+/* Initializes the table of shared pages and the zero frame. */
+void
+page_init (void)
+{
+  hash_init (&shared_pages, shared_hash, shared_less, NULL);
+  zero_frame.kpage = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+}
+
+/* Creates an empty supplemental page table for the current
+   thread.  Returns true if successful, false if memory
+   allocation fails. */
+bool
+page_table_create (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->pages == NULL);
+
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL)
+    return false;
+  if (!hash_init (t->pages, page_hash, page_less, NULL))
+    {
+      free (t->pages);
+      t->pages = NULL;
+      return false;
+    }
+  return true;
+}
+
+/* Destroys the current thread's supplemental page table, if it
+   has one, freeing its pages' frames and swap slots.  Must be
+   called before the thread's page directory is destroyed. */
+void
+page_table_destroy (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->pages != NULL)
+    {
+      frame_acquire ();
+      hash_destroy (t->pages, page_destroy);
+      frame_release ();
+      free (t->pages);
+      t->pages = NULL;
+    }
+}
+
+/* Returns the current thread's page that contains virtual
+   address ADDR, or a null pointer if there is none. */
+struct page *
+page_lookup (const void *addr)
+{
+  struct thread *t = thread_current ();
+  struct page p;
+  struct hash_elem *e;
+
+  if (t->pages == NULL || !is_user_vaddr (addr))
+    return NULL;
+  p.upage = pg_round_down (addr);
+  e = hash_find (t->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Adds a page at UPAGE to the current thread's page table,
+   whose contents are READ_BYTES bytes of FILE starting at OFS
+   followed by zeros.  FILE must remain open as long as the page
+   exists.  The user process may modify the page if WRITABLE is
+   true, but modifications are not written back to FILE.  Returns
+   true if successful, false if UPAGE is already in the table or
+   if memory allocation fails. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  return add_page (upage, file, ofs, read_bytes, writable, false);
+}
+
+/* Adds an all-zero page at UPAGE to the current thread's page
+   table.  Returns true if successful, false if UPAGE is already
+   in the table or if memory allocation fails. */
+bool
+page_add_zero (void *upage, bool writable)
+{
+  return add_page (upage, NULL, 0, 0, writable, false);
+}
+
+/* Adds a writable page at UPAGE to the current thread's page
+   table that maps READ_BYTES bytes of FILE starting at OFS, for
+   a memory-mapped file.  The page is loaded from FILE when it is
+   first touched, and its first READ_BYTES bytes are written back
+   to FILE if they are modified, when the page is evicted or
+   removed.  Returns true if successful, false if UPAGE is
+   already in the table or if memory allocation fails. */
+bool
+page_add_mmap (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes)
+{
+  ASSERT (file != NULL && read_bytes > 0);
+  return add_page (upage, file, ofs, read_bytes, true, true);
+}
+
+/* Removes the page at UPAGE from the current thread's page
+   table, writing it back to its file first if it is a modified
+   page of a memory-mapped file. */
+void
+page_remove (void *upage)
+{
+  struct page *p = page_lookup (upage);
+
+  if (p != NULL)
+    {
+      frame_acquire ();
+      hash_delete (thread_current ()->pages, &p->hash_elem);
+      page_destroy (&p->hash_elem, NULL);
+      frame_release ();
+    }
+}
+
+/* Adds a page to the current thread's page table, as described
+   for page_add_file() and page_add_mmap(). */
+static bool
+add_page (void *upage, struct file *file, off_t ofs, size_t read_bytes,
+          bool writable, bool write_back)
+{
+  struct page *p;
+  bool success = true;
+
+  p = new_page (upage, file, ofs, read_bytes, writable, write_back);
+  if (p == NULL)
+    return false;
+  if (!writable && p->file != NULL)
+    {
+      frame_acquire ();
+      success = share_page (p);
+      frame_release ();
+      if (!success)
+        {
+          hash_delete (thread_current ()->pages, &p->hash_elem);
+          free (p);
+        }
+    }
+  return success;
+}
+
+/* Creates a page as described for add_page(), adds it to the
+   current thread's page table, and returns it.  Returns a null
+   pointer if UPAGE is already in the table or if memory
+   allocation fails. */
+static struct page *
+new_page (void *upage, struct file *file, off_t ofs, size_t read_bytes,
+          bool writable, bool write_back)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->writable = writable;
+  p->file = read_bytes > 0 ? file : NULL;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  p->owner = t;
+  p->frame = NULL;
+  p->swap_slot = SWAP_ERROR;
+  p->dirty = false;
+  p->write_back = write_back;
+  p->shared = NULL;
+  if (hash_insert (t->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Adds read-only file page P to the shared page for its inode,
+   offset, and number of bytes read, creating the shared page if
+   no other process maps that part of the file.  Returns true if
+   successful, false if memory allocation fails.  The frame lock
+   must be held. */
+static bool
+share_page (struct page *p)
+{
+  struct shared_page key, *s;
+  struct hash_elem *e;
+
+  key.inode = file_get_inode (p->file);
+  key.ofs = p->file_ofs;
+  key.read_bytes = p->read_bytes;
+
+  e = hash_find (&shared_pages, &key.hash_elem);
+  if (e != NULL)
+    s = hash_entry (e, struct shared_page, hash_elem);
+  else
+    {
+      s = malloc (sizeof *s);
+      if (s == NULL)
+        return false;
+      s->inode = key.inode;
+      s->ofs = key.ofs;
+      s->read_bytes = key.read_bytes;
+      s->frame = NULL;
+      s->swap_slot = SWAP_ERROR;
+      list_init (&s->pages);
+      hash_insert (&shared_pages, &s->hash_elem);
+    }
+  list_push_back (&s->pages, &p->shared_elem);
+  p->shared = s;
+  return true;
+}
+
+/* Copies PARENT's pages into the current thread's page table,
+   which must be empty, for fork().  Pages of memory-mapped files
+   are not copied.  Pages that PARENT has loaded are shared
+   copy-on-write, and pages loaded from PARENT's executable are
+   loaded from EXEC_FILE instead.  Returns true if successful,
+   false if memory allocation fails. */
+bool
+page_table_fork (struct thread *parent, struct file *exec_file)
+{
+  struct hash_iterator i;
+  bool success = true;
+
+  frame_acquire ();
+  hash_first (&i, parent->pages);
+  while (success && hash_next (&i))
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, hash_elem);
+      if (!p->write_back)
+        success = fork_page (p, exec_file);
+    }
+  frame_release ();
+  return success;
+}
+
+/* Adds a copy of page P, which belongs to the current thread's
+   parent, to the current thread's page table, as described for
+   page_table_fork().  The frame lock must be held. */
+static bool
+fork_page (struct page *p, struct file *exec_file)
+{
+  struct shared_page *s;
+  struct page *c;
+
+  c = new_page (p->upage, exec_file, p->file_ofs, p->read_bytes,
+                p->writable, false);
+  if (c == NULL)
+    return false;
+  c->dirty = p->dirty;
+
+  if (p->shared != NULL && p->shared->inode != NULL)
+    return share_page (c);
+  if (p->shared == NULL)
+    {
+      /* A page that P's process has not loaded or written yet can
+         be loaded by each process on its own. */
+      if ((p->frame == NULL || p->frame == &zero_frame)
+          && p->swap_slot == SWAP_ERROR)
+        return true;
+
+      s = malloc (sizeof *s);
+      if (s == NULL)
+        return false;
+      s->inode = NULL;
+      s->frame = p->frame;
+      s->swap_slot = p->swap_slot;
+      list_init (&s->pages);
+      list_push_back (&s->pages, &p->shared_elem);
+      p->shared = s;
+      p->swap_slot = SWAP_ERROR;
+
+      /* Take away write access to P's frame. */
+      if (p->frame != NULL)
+        {
+          uint32_t *pd = p->owner->pagedir;
+
+          pagedir_clear_page (pd, p->upage);
+          if (pagedir_is_dirty (pd, p->upage))
+            p->dirty = c->dirty = true;
+          pagedir_set_page (pd, p->upage, p->frame->kpage, false);
+        }
+    }
+  list_push_back (&p->shared->pages, &c->shared_elem);
+  c->shared = p->shared;
+  return true;
+}
+
+/* Makes page P present in its owner's page directory, reading
+   its contents from swap or its file or zeroing it as needed, and
+   pins its frame.  Unless WRITE is true, an all-zero page that
+   has not been written is mapped to the zero frame instead.
+   Returns true if successful, false if no frame can be obtained
+   or reading fails.  The frame lock must be held. */
+static bool
+pin_page (struct page *p, bool write)
+{
+  struct frame *f;
+
+  if (p->frame != NULL)
+    {
+      p->frame->pin_cnt++;
+      return true;
+    }
+
+  if (!write && p->file == NULL && p->swap_slot == SWAP_ERROR
+      && p->shared == NULL && !p->dirty)
+    {
+      if (!pagedir_set_page (p->owner->pagedir, p->upage, zero_frame.kpage,
+                             false))
+        return false;
+      zero_frame.pin_cnt++;
+      p->frame = &zero_frame;
+      return true;
+    }
+
+  /* Map the shared frame, if another process already has it. */
+  if (p->shared != NULL && p->shared->frame != NULL)
+    {
+      f = p->shared->frame;
+      if (!pagedir_set_page (p->owner->pagedir, p->upage, f->kpage, false))
+        return false;
+      f->pin_cnt++;
+      p->frame = f;
+      return true;
+    }
+
+  f = frame_alloc (p);
+  if (f == NULL)
+    return false;
+
+  if (p->shared != NULL && p->shared->swap_slot != SWAP_ERROR)
+    {
+      swap_in (p->shared->swap_slot, f->kpage);
+      p->shared->swap_slot = SWAP_ERROR;
+    }
+  else if (p->swap_slot != SWAP_ERROR)
+    {
+      swap_in (p->swap_slot, f->kpage);
+      p->swap_slot = SWAP_ERROR;
+    }
+  else if (p->file != NULL)
+    {
+      if (file_read_at (p->file, f->kpage, p->read_bytes, p->file_ofs)
+          != (off_t) p->read_bytes)
+        {
+          frame_free (f);
+          return false;
+        }
+      memset ((uint8_t *) f->kpage + p->read_bytes, 0,
+              PGSIZE - p->read_bytes);
+    }
+  else
+    memset (f->kpage, 0, PGSIZE);
+
+  if (!pagedir_set_page (p->owner->pagedir, p->upage, f->kpage,
+                         p->writable && p->shared == NULL))
+    {
+      frame_free (f);
+      return false;
+    }
+  p->frame = f;
+  if (p->shared != NULL)
+    p->shared->frame = f;
+  return true;
+}
+
+/* Returns true if writing page P requires unshare_page() first,
+   because P is mapped to the zero frame or is copy-on-write. */
+static bool
+needs_unshare (const struct page *p)
+{
+  return (p->frame == &zero_frame
+          || (p->shared != NULL && p->shared->inode == NULL));
+}
+
+/* Gives page P, for which needs_unshare() is true, a private,
+   writable copy of its contents, unless it is the last page
+   sharing them, in which case it simply takes them over.
+   Returns true if successful, false if no frame can be obtained.
+   The frame lock must be held. */
+static bool
+unshare_page (struct page *p)
+{
+  struct shared_page *s = p->shared;
+  uint32_t *pd = p->owner->pagedir;
+  struct frame *f;
+
+  ASSERT (needs_unshare (p));
+
+  if (p->frame == &zero_frame)
+    {
+      f = frame_alloc (p);
+      if (f == NULL)
+        return false;
+      memset (f->kpage, 0, PGSIZE);
+      pagedir_clear_page (pd, p->upage);
+      p->frame = f;
+      pagedir_set_page (pd, p->upage, f->kpage, true);
+      f->pin_cnt--;
+      return true;
+    }
+  else if (list_size (&s->pages) == 1)
+    {
+      f = s->frame;
+      p->swap_slot = s->swap_slot;
+      free (s);
+      p->shared = NULL;
+      if (p->frame != NULL)
+        pagedir_clear_page (pd, p->upage);
+      p->frame = f;
+      if (f != NULL)
+        {
+          f->page = p;
+          pagedir_set_page (pd, p->upage, f->kpage, true);
+        }
+    }
+  else
+    {
+      /* Bring in the shared frame, so that it can be copied, and
+         pin it, so that it stays while the copy's frame is
+         allocated. */
+      if (!pin_page (p, false))
+        return false;
+      f = frame_alloc (p);
+      if (f == NULL)
+        {
+          p->frame->pin_cnt--;
+          return false;
+        }
+      memcpy (f->kpage, s->frame->kpage, PGSIZE);
+      pagedir_clear_page (pd, p->upage);
+      s->frame->pin_cnt--;
+      list_remove (&p->shared_elem);
+      if (s->frame->page == p)
+        s->frame->page = list_entry (list_front (&s->pages),
+                                     struct page, shared_elem);
+      p->shared = NULL;
+      p->frame = f;
+      pagedir_set_page (pd, p->upage, f->kpage, true);
+      f->pin_cnt--;
+    }
+
+  /* The contents may differ from P's initial contents now. */
+  p->dirty = true;
+  return true;
+}
+
+/* Handles a write to the copy-on-write or zero-mapped page that
+   contains ADDR by giving the current thread a private copy of
+   it.  Returns true if successful, false if ADDR is not in such
+   a writable page of the current thread's or if no frame can be
+   obtained. */
+bool
+page_unshare (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+  bool success;
+
+  if (p == NULL || !p->writable || !needs_unshare (p))
+    return false;
+  frame_acquire ();
+  success = unshare_page (p);
+  frame_release ();
+  return success;
+}
+
+/* Makes the page that contains ADDR present in the current
+   thread's page directory, loading it if necessary.  WRITE
+   should be true if the page is about to be written, so that an
+   all-zero page gets a frame of its own right away.  Returns true
+   if successful, false if ADDR is not in a page of the current
+   thread's or if memory allocation or file reading fails. */
+bool
+page_in (const void *addr, bool write)
+{
+  struct page *p = page_lookup (addr);
+  bool success;
+
+  if (p == NULL)
+    return false;
+  frame_acquire ();
+  success = pin_page (p, write);
+  if (success)
+    p->frame->pin_cnt--;
+  frame_release ();
+  return success;
+}
+
+/* Grows the current thread's stack to include ADDR, if ADDR is
+   not already in a page and looks like a stack access given user
+   stack pointer ESP, and makes the new page present.  Returns
+   true if successful, false otherwise. */
+bool
+page_grow_stack (const void *addr, const void *esp)
+{
+  return add_stack_page (addr, esp) != NULL && page_in (addr, true);
+}
+
+/* Adds an all-zero stack page to the current thread's page table
+   for ADDR and returns it, if ADDR is within page_stack_max of
+   the top of user memory and no more than 32 bytes below user
+   stack pointer ESP, which PUSHA may touch before updating the
+   stack pointer.  Returns a null pointer if ADDR is not a stack
+   access or if memory allocation fails. */
+static struct page *
+add_stack_page (const void *addr, const void *esp)
+{
+  uint8_t *upage = pg_round_down (addr);
+
+  if (!is_user_vaddr (addr)
+      || (size_t) ((uint8_t *) PHYS_BASE - upage) > page_stack_max
+      || (const uint8_t *) addr + 32 < (const uint8_t *) esp
+      || !page_add_zero (upage, true))
+    return NULL;
+  return page_lookup (upage);
+}
+
+/* Makes every page in the SIZE bytes starting at ADDR present and
+   pins them, so that the kernel can access them without faulting
+   until page_unpin_range() is called, growing the stack to
+   include any of them that are stack accesses.  If WRITE is true,
+   the pages must also be writable.  Returns true if successful, false
+   if any of the bytes is not in a suitable page of the current
+   thread's, in which case no pages are left pinned. */
+bool
+page_pin_range (const void *addr, size_t size, bool write)
+{
+  const uint8_t *last = (const uint8_t *) addr + size - 1;
+  const uint8_t *upage;
+
+  if (size == 0)
+    return true;
+  if (last < (const uint8_t *) addr || !is_user_vaddr (last))
+    return false;
+
+  frame_acquire ();
+  for (upage = pg_round_down (addr); upage <= last; upage += PGSIZE)
+    {
+      struct page *p = page_lookup (upage);
+      if (p == NULL)
+        p = add_stack_page (upage < (const uint8_t *) addr ? addr : upage,
+                            thread_current ()->user_esp);
+      if (p == NULL || (write && !p->writable))
+        break;
+      if (write && needs_unshare (p) && !unshare_page (p))
+        break;
+      if (!pin_page (p, write))
+        break;
+    }
+  frame_release ();
+
+  if (upage <= last)
+    {
+      if (upage > (const uint8_t *) pg_round_down (addr))
+        page_unpin_range (addr, upage - (const uint8_t *) addr);
+      return false;
+    }
+  return true;
+}
+
+/* Unpins the pages in the SIZE bytes starting at ADDR, which were
+   pinned by page_pin_range(). */
+void
+page_unpin_range (const void *addr, size_t size)
+{
+  const uint8_t *last = (const uint8_t *) addr + size - 1;
+  const uint8_t *upage;
+
+  if (size == 0)
+    return;
+  frame_acquire ();
+  for (upage = pg_round_down (addr); upage <= last; upage += PGSIZE)
+    {
+      struct page *p = page_lookup (upage);
+      if (p != NULL && p->frame != NULL)
+        p->frame->pin_cnt--;
+    }
+  frame_release ();
+}
+
+/* Takes page P, which must be present and unpinned, out of its
+   frame so that the frame can be reused, saving its contents to
+   swap, or to its file for a memory-mapped file, if they were
+   modified.  A shared page is unmapped from
+   every process that shares it.  Returns true if successful,
+   false if swap is full, in which case P stays in its frame.  The
+   frame lock must be held. */
+bool
+page_out (struct page *p)
+{
+  uint32_t *pd = p->owner->pagedir;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (p->frame->pin_cnt == 0);
+
+  if (p->shared != NULL)
+    {
+      struct list_elem *e;
+
+      if (p->shared->inode == NULL)
+        {
+          p->shared->swap_slot = swap_out (p->frame->kpage);
+          if (p->shared->swap_slot == SWAP_ERROR)
+            return false;
+        }
+      for (e = list_begin (&p->shared->pages);
+           e != list_end (&p->shared->pages); e = list_next (e))
+        {
+          struct page *q = list_entry (e, struct page, shared_elem);
+          if (q->frame != NULL)
+            {
+              pagedir_clear_page (q->owner->pagedir, q->upage);
+              q->frame = NULL;
+            }
+        }
+      p->shared->frame = NULL;
+      return true;
+    }
+
+  /* Unmap the page before checking whether it is dirty, so that
+     the process cannot modify it in between. */
+  pagedir_clear_page (pd, p->upage);
+  if (pagedir_is_dirty (pd, p->upage))
+    p->dirty = true;
+
+  if (p->write_back)
+    {
+      if (p->dirty)
+        {
+          file_write_at (p->file, p->frame->kpage, p->read_bytes,
+                         p->file_ofs);
+          p->dirty = false;
+        }
+    }
+  else if (p->dirty)
+    {
+      p->swap_slot = swap_out (p->frame->kpage);
+      if (p->swap_slot == SWAP_ERROR)
+        {
+          pagedir_set_page (pd, p->upage, p->frame->kpage, p->writable);
+          return false;
+        }
+    }
+  p->frame = NULL;
+  return true;
+}
+
+/* Returns true if page P, which must be present, has been
+   accessed since the last call, and clears its accessed bit.  A
+   shared page counts as accessed if any process that maps it
+   accessed it.  The frame lock must be held. */
+bool
+page_accessed_recently (struct page *p)
+{
+  struct list_elem *e;
+  bool accessed;
+
+  if (p->shared == NULL)
+    {
+      uint32_t *pd = p->owner->pagedir;
+
+      if (!pagedir_is_accessed (pd, p->upage))
+        return false;
+      pagedir_set_accessed (pd, p->upage, false);
+      return true;
+    }
+
+  accessed = false;
+  for (e = list_begin (&p->shared->pages); e != list_end (&p->shared->pages);
+       e = list_next (e))
+    {
+      struct page *q = list_entry (e, struct page, shared_elem);
+      if (q->frame != NULL && pagedir_is_accessed (q->owner->pagedir,
+                                                   q->upage))
+        {
+          pagedir_set_accessed (q->owner->pagedir, q->upage, false);
+          accessed = true;
+        }
+    }
+  return accessed;
+}
+
+/* Returns a hash value for the page that contains E. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if the page that contains A_ precedes the one that
+   contains B_. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+  return a->upage < b->upage;
+}
+
+/* Frees the page that contains E, along with its frame or swap
+   slot, first writing it back if it is a modified page of a
+   memory-mapped file.  The frame of a shared page is freed only
+   with the last page that shares it.  The frame lock must be
+   held. */
+static void
+page_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry (e, struct page, hash_elem);
+
+  if (p->frame != NULL)
+    {
+      uint32_t *pd = p->owner->pagedir;
+
+      pagedir_clear_page (pd, p->upage);
+      if (p->write_back && (p->dirty || pagedir_is_dirty (pd, p->upage)))
+        file_write_at (p->file, p->frame->kpage, p->read_bytes,
+                       p->file_ofs);
+    }
+  if (p->shared != NULL)
+    {
+      struct shared_page *s = p->shared;
+
+      list_remove (&p->shared_elem);
+      if (list_empty (&s->pages))
+        {
+          if (s->frame != NULL)
+            frame_free (s->frame);
+          if (s->swap_slot != SWAP_ERROR)
+            swap_free (s->swap_slot);
+          if (s->inode != NULL)
+            hash_delete (&shared_pages, &s->hash_elem);
+          free (s);
+        }
+      else if (s->frame != NULL && s->frame->page == p)
+        s->frame->page = list_entry (list_front (&s->pages),
+                                     struct page, shared_elem);
+    }
+  else if (p->frame != NULL && p->frame != &zero_frame)
+    frame_free (p->frame);
+  if (p->swap_slot != SWAP_ERROR)
+    swap_free (p->swap_slot);
+  free (p);
+}
+
+/* Returns a hash value for the shared page that contains E. */
+static unsigned
+shared_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct shared_page *s = hash_entry (e, struct shared_page, hash_elem);
+  return (hash_bytes (&s->inode, sizeof s->inode) ^ hash_int (s->ofs)
+          ^ hash_int (s->read_bytes));
+}
+
+/* Returns true if the shared page that contains A_ precedes the
+   one that contains B_. */
+static bool
+shared_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct shared_page *a = hash_entry (a_, struct shared_page,
+                                            hash_elem);
+  const struct shared_page *b = hash_entry (b_, struct shared_page,
+                                            hash_elem);
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->read_bytes < b->read_bytes;
+}
@@ -0,0 +1,72 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct frame;
+struct shared_page;
+
+/* A page of user virtual memory, as recorded in its process's
+   supplemental page table.  Every page a process may access has
+   one of these, whether or not it is currently mapped in the
+   process's page directory. */
+struct page
+  {
+    struct hash_elem hash_elem; /* Element in thread's page table. */
+    void *upage;                /* User virtual address. */
+    bool writable;              /* Writable by the user process? */
+
+    /* Initial contents: READ_BYTES bytes read from FILE starting
+       at FILE_OFS, followed by zeros.  FILE is null for a page
+       that starts out all zeros. */
+    struct file *file;
+    off_t file_ofs;
+    size_t read_bytes;
+
+    /* Residency, protected by the frame lock (see vm/frame.c).
+       A page is in at most one of a frame or a swap slot.  If it
+       is in neither, its initial contents are reloaded. */
+    struct thread *owner;       /* Owning thread. */
+    struct frame *frame;        /* Frame holding the page, or null. */
+    size_t swap_slot;           /* Swap slot holding the page, or
+                                   SWAP_ERROR. */
+    bool dirty;                 /* Modified since being initialized? */
+    bool write_back;            /* Write modified contents back to FILE
+                                   instead of to swap? */
+
+    /* Read-only file pages share one frame among every process
+       that maps the same part of the same file, and fork() shares
+       other pages copy-on-write. */
+    struct shared_page *shared; /* Shared frame record, or null. */
+    struct list_elem shared_elem; /* Element in shared->pages. */
+  };
+
+/* Maximum size of a user stack, in bytes. */
+extern size_t page_stack_max;
+
+void page_init (void);
+bool page_table_create (void);
+void page_table_destroy (void);
+bool page_table_fork (struct thread *parent, struct file *exec_file);
+
+struct page *page_lookup (const void *);
+bool page_add_file (void *upage, struct file *, off_t, size_t read_bytes,
+                    bool writable);
+bool page_add_zero (void *upage, bool writable);
+bool page_add_mmap (void *upage, struct file *, off_t, size_t read_bytes);
+void page_remove (void *upage);
+
+bool page_in (const void *, bool write);
+bool page_grow_stack (const void *addr, const void *esp);
+bool page_unshare (const void *);
+bool page_pin_range (const void *, size_t, bool write);
+void page_unpin_range (const void *, size_t);
+
+bool page_out (struct page *);
+bool page_accessed_recently (struct page *);
+
+#endif /* vm/page.h */
@@ -0,0 +1,77 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Pages are written to the swap device in slots of
+   SECTORS_PER_PAGE consecutive sectors, each transferred with a
+   single multi-sector request. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *swap_device;   /* Swap device, or null if none. */
+static struct bitmap *swap_map;     /* Used slots, one bit per slot. */
+static struct lock swap_lock;       /* Protects swap_map. */
+
+/* Initializes swap.  If there is no swap device, swap_out()
+   always fails. */
+void
+swap_init (void)
+{
+  size_t slot_cnt;
+
+  lock_init (&swap_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    {
+      printf ("swap: no swap device, pages cannot be swapped out\n");
+      slot_cnt = 0;
+    }
+  else
+    slot_cnt = block_size (swap_device) / SECTORS_PER_PAGE;
+  swap_map = bitmap_create (slot_cnt);
+  if (swap_map == NULL)
+    PANIC ("swap bitmap creation failed");
+}
+
+/* Writes the page at KPAGE to a free swap slot and returns the
+   slot, or returns SWAP_ERROR if swap is full. */
+size_t
+swap_out (const void *kpage)
+{
+  size_t slot;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_map, 0, 1, false);
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return SWAP_ERROR;
+
+  block_write_multiple (swap_device, slot * SECTORS_PER_PAGE,
+                        SECTORS_PER_PAGE, kpage);
+  return slot;
+}
+
+/* Reads the page in swap slot SLOT into KPAGE and frees the
+   slot. */
+void
+swap_in (size_t slot, void *kpage)
+{
+  ASSERT (slot != SWAP_ERROR);
+
+  block_read_multiple (swap_device, slot * SECTORS_PER_PAGE,
+                       SECTORS_PER_PAGE, kpage);
+  swap_free (slot);
+}
+
+/* Frees swap slot SLOT without reading it. */
+void
+swap_free (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_map, slot));
+  bitmap_reset (swap_map, slot);
+  lock_release (&swap_lock);
+}